@@ -0,0 +1,68 @@
+// checks limeguy_obs_resize (area) and limeguy_obs_pool2 against a scalar rounded mean, also for cells
+// that are not a power of two in size (make obs_check)
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "src/limeguy_obs.h"
+
+#define WIDTH  160
+#define HEIGHT 144
+
+// same cells as the resizer: [ii * src_size / size, (ii + 1) * src_size / size)
+static
+int cell_begin(int ii, int src_size, int size) {
+	return ii * src_size / size;
+}
+
+static
+int cell_end(int ii, int src_size, int size) {
+	int end = (ii + 1) * src_size / size;
+	return end > cell_begin(ii, src_size, size) ? end : cell_begin(ii, src_size, size) + 1;
+}
+
+// pool2: 80 x 72 through limeguy_obs_pool2 instead of the resizer
+static
+int check(const uint8_t* screen, int width, int height, bool pool2) {
+	struct limeguy_obs_resizer* rs = limeguy_obs_resizer_create(width, height, LIMEGUY_OBS_AREA);
+	uint8_t* out = malloc((size_t)width * height);
+	if (pool2)
+		limeguy_obs_pool2(screen, 1, out, limeguy_obs_default_gray);
+	else
+		limeguy_obs_resize(rs, screen, 1, out, limeguy_obs_default_gray);
+	int bad = 0;
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			uint32_t sum = 0, n = 0;
+			for (int sy = cell_begin(y, HEIGHT, height); sy < cell_end(y, HEIGHT, height); ++sy) {
+				for (int sx = cell_begin(x, WIDTH, width); sx < cell_end(x, WIDTH, width); ++sx) {
+					sum += limeguy_obs_default_gray[screen[sy * WIDTH + sx]];
+					++n;
+				}
+			}
+			if (out[y * width + x] != (sum + n / 2) / n)
+				++bad;
+		}
+	}
+	printf("%3d x %3d%s: %s (%d pixels off)\n", width, height, pool2 ? " pool2" : "", bad ? "FAIL" : "ok", bad);
+	free(out);
+	limeguy_obs_resizer_destroy(rs);
+	return bad;
+}
+
+int main(void) {
+	static const int sizes[][2] = {
+		{80, 72}, {84, 84}, {53, 48}, {32, 32}, {27, 21}, {7, 5}, {1, 1}, {160, 144}, {200, 160},
+	};
+	uint8_t screen[WIDTH * HEIGHT];
+	srand(1);
+	int bad = 0;
+	for (int round = 0; round < 3; ++round) {
+		for (int ii = 0; ii < WIDTH * HEIGHT; ++ii) // round 0: all white, then noise with LCD off
+			screen[ii] = round == 0 ? 0 : rand() % (round == 1 ? 4 : 5);
+		for (size_t ss = 0; ss < sizeof(sizes) / sizeof(sizes[0]); ++ss)
+			bad += check(screen, sizes[ss][0], sizes[ss][1], false);
+		bad += check(screen, WIDTH / 2, HEIGHT / 2, true);
+	}
+	return bad != 0;
+}
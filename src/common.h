@@ -6,15 +6,43 @@
 typedef int8_t   i8;   // signed byte
 typedef uint8_t  u8;   // unsigned byte
 typedef uint16_t u16;  // unsigned word
+typedef uint32_t u32;  // unsigned double word
 
 typedef uint8_t gb_color_idx; // 2 bit color index (before applying palette)
 typedef uint8_t gb_color;     // 2 bit color (after applying palette)
 
-struct limeguy_color {
+struct rgba_color {
 	u8 r;
 	u8 g;
 	u8 b;
 	u8 a;
 };
 
+// pixel formats for output target
+enum ppu_pixel_format {
+	PPU_PIXFMT_RGBA8888, // bytes R, G, B, A
+	PPU_PIXFMT_BGRA8888, // bytes B, G, R, A
+	PPU_PIXFMT_RGB565,   // 16 bit, native endianness
+	PPU_PIXFMT_GRAY8     // 8 bit luminance
+};
+
+// parts of an instance start on their own cache lines (see gameboy.c)
+#define CACHE_LINE       64
+#define CACHE_ALIGN(size) (((size) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1))
+
+// save states hold no host addresses: pointer field of a struct saved at buf is zeroed
+#define STATE_CLEAR(buf, type, field) \
+	memset((void*)((char*)(buf) + offsetof(type, field)), 0, sizeof(((type*)0)->field))
+
+enum gb_button { // correspond to bit nrs in button_state
+	BUT_RIGHT = 0,
+	BUT_LEFT,
+	BUT_UP,
+	BUT_DOWN,
+	BUT_A,
+	BUT_B,
+	BUT_SELECT,
+	BUT_START
+};
+
 #endif
@@ -8,7 +8,7 @@
 #define OPCODE_PREFIX 0xCB
 
 static
-void cpu_init(struct cpu* cpu) {
+void cpu_reset(struct cpu* cpu) {
 	// game boy doctor state:
 	for (int ii = REG_A; ii <= REG_L; ++ii)
 		cpu->regs[ii] = 0;
@@ -34,7 +34,7 @@ void cpu_init(struct cpu* cpu) {
 }
 
 void cpu_initregs_gbdoctor(struct cpu* cpu) {
-	cpu_init(cpu);
+	cpu_reset(cpu);
 	// game boy doctor state:
 	cpu->regs[REG_A] = 0x01;
 	cpu->regs[REG_C] = 0x13;
@@ -47,7 +47,7 @@ void cpu_initregs_gbdoctor(struct cpu* cpu) {
 }
 
 void cpu_initregs_dmg0(struct cpu* cpu) {
-	cpu_init(cpu);
+	cpu_reset(cpu);
 	cpu->regs[REG_A] = 0x01;
 	cpu->regs[REG_B] = 0xFF;
 	cpu->regs[REG_C] = 0x13;
@@ -56,16 +56,28 @@ void cpu_initregs_dmg0(struct cpu* cpu) {
 	cpu->regs[REG_L] = 0x03;
 }
 
-struct cpu* cpu_create(struct mem* mem, struct mcycle* mcycle) {
-	struct cpu* cpu = malloc(sizeof(struct cpu));
+void cpu_init(struct cpu* cpu, struct mem* mem, struct mcycle* mcycle) {
 	cpu->mem = mem;
 	cpu->mcycle = mcycle;
-	cpu_init(cpu);
-	return cpu;
+	cpu_reset(cpu);
 }
 
-void cpu_destroy(struct cpu* cpu) {
-	free(cpu);
+size_t cpu_state_size(void) {
+	return sizeof(struct cpu);
+}
+
+void cpu_save_state(struct cpu* cpu, void* buf) {
+	memcpy(buf, cpu, sizeof(struct cpu));
+	STATE_CLEAR(buf, struct cpu, mem);
+	STATE_CLEAR(buf, struct cpu, mcycle);
+}
+
+void cpu_load_state(struct cpu* cpu, const void* buf) {
+	struct mem* mem = cpu->mem;
+	struct mcycle* mcycle = cpu->mcycle;
+	memcpy(cpu, buf, sizeof(struct cpu));
+	cpu->mem = mem;
+	cpu->mcycle = mcycle;
 }
 
 bool cpu_is_stopped(struct cpu* cpu) {
@@ -927,7 +939,7 @@ static void SRL(struct cpu* cpu, struct instruction* instr) {
 
 static void STOP(struct cpu* cpu, struct instruction* instr) {
 	(void)instr;
-	printf("CPU: STOP instr at %04X\n", cpu->PC - 1);
+	fprintf(stderr, "CPU: STOP instr at %04X\n", cpu->PC - 1);
 	cpu->stopped = true;
 }
 
@@ -967,7 +979,7 @@ static void PREFIX(struct cpu* cpu, struct instruction* instr) {
 static void ILLEGAL(struct cpu* cpu, struct instruction* instr) {
 	(void)cpu;
 	(void)instr;
-	printf("%s not implemented yet\n", instr->mnemonic);
+	fprintf(stderr, "%s not implemented yet\n", instr->mnemonic);
 }
 
 
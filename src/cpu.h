@@ -42,6 +42,10 @@ struct flags {
 struct instruction; // declare for next part
 
 struct cpu {
+	// hot: used by every instruction
+	struct mem*  mem;
+	struct mcycle* mcycle;
+
 	// registers & flags
 	u8           regs[NR_REGS];
 	u16          SP;
@@ -51,21 +55,19 @@ struct cpu {
 	bool         ime; // interrupt master enbl
 	bool         ei_initiated; // helper for instruction delay of EI
 
-	unsigned int cycles_left; // to keep track of instr cycles
-
-	struct mem*  mem;
-	struct mcycle* mcycle;
-
 	bool halted;
 	bool haltbug;
 
 	bool stopped;
 
-	unsigned int nr_mcycles_frame; // mcycle counter that can be reset
+	unsigned int cycles_left; // to keep track of instr cycles
 
-	// FIXME: DEBUG VARS
 	unsigned int nr_mcycles;
 	unsigned int nr_instructions;
+	unsigned int nr_mcycles_frame; // mcycle counter that can be reset
+
+	// cold
+	// FIXME: DEBUG VARS
 	unsigned int interrupt_count[5];
 };
 
@@ -83,8 +85,8 @@ struct instruction {
 };
 
 
-struct cpu* cpu_create(struct mem* mem, struct mcycle* mcycle);
-void cpu_destroy(struct cpu* cpu);
+// cpu in caller memory (part of gameboy arena)
+void cpu_init(struct cpu* cpu, struct mem* mem, struct mcycle* mcycle);
 
 void cpu_initregs_gbdoctor(struct cpu* cpu);
 void cpu_initregs_dmg0(struct cpu* cpu);
@@ -92,6 +94,11 @@ void cpu_initregs_dmg0(struct cpu* cpu);
 void cpu_run_instruction(struct cpu* cpu);
 bool cpu_is_stopped(struct cpu* cpu);
 
+// save states: cpu_load_state keeps connections (mem, mcycle) of cpu
+size_t cpu_state_size(void);
+void cpu_save_state(struct cpu* cpu, void* buf);
+void cpu_load_state(struct cpu* cpu, const void* buf);
+
 void cpu_reset_mcycle_frame(struct cpu* cpu);
 unsigned int cpu_get_mcycle_frame(struct cpu* cpu);
 
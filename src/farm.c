@@ -0,0 +1,284 @@
+// Test farm: runs a manifest of ROMs as in-process instances on a work-stealing
+// thread pool, and writes one JSON result line per ROM (in order of completion)
+//
+// Manifest: one ROM per line, optionally followed by limits for that ROM:
+//   roms/cpu_instrs/01-special.gb mcycles=9000000 frames=600 instrs=9000000
+// Empty lines and lines starting with # are skipped. Limits on the command line are defaults
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "limeguy.h"
+#include "threadpool.h"
+#include "common.h"
+
+#define FARM_DEFAULT_MCYCLES 10000000
+#define FARM_INSTR_CHECK     1024 /* instruction limit is checked every so many mcycles */
+#define FARM_SERIAL_MAX      1024
+
+struct farm_job {
+	char*        rom_file;
+	unsigned int max_mcycles; // 0: no limit
+	unsigned int max_frames;
+	unsigned int max_instrs;
+};
+
+struct farm {
+	struct farm_job* jobs;
+	int              nr_jobs;
+	FILE*            out;
+	pthread_mutex_t  out_lock;
+	int              nr_passed;
+	int              nr_failed; // failed, error
+};
+
+struct farm_result {
+	const char*  status; // passed, failed, timeout, stopped, error
+	unsigned int mcycles;
+	unsigned int frames;
+	unsigned int instrs;
+	double       seconds;
+	uint64_t     screen_hash;
+	char         serial[FARM_SERIAL_MAX + 1];
+	int          serial_len;
+};
+
+void print_usage(char* progname) {
+	printf("Usage: %s [-j threads] [-p] [-m mcycles] [-f frames] [-i instrs] [-o outfile] <manifest>\n", progname);
+	printf("  -j: nr of worker threads (default: one per core)\n");
+	printf("  -p: pin worker threads to cores\n");
+	printf("  -m, -f, -i: default limits per ROM (0: none; default: -m %d)\n", FARM_DEFAULT_MCYCLES);
+	printf("  -o: write results to outfile instead of stdout\n");
+	printf("  manifest: ROM per line, optional limits: rom mcycles=# frames=# instrs=#. '-': stdin\n");
+}
+
+static
+u8* read_file(const char* fname, size_t* size) {
+	FILE* f = fopen(fname, "rb");
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	u8* data = len > 0 ? malloc(len) : NULL;
+	if (data && fread(data, 1, len, f) != (size_t)len) {
+		free(data);
+		data = NULL;
+	}
+	fclose(f);
+	*size = len > 0 ? (size_t)len : 0;
+	return data;
+}
+
+static
+bool parse_manifest(FILE* f, struct farm* farm, const struct farm_job* defaults) {
+	char* line = NULL;
+	size_t line_cap = 0;
+	int cap = 0;
+	int line_nr = 0;
+	while (getline(&line, &line_cap, f) >= 0) {
+		++line_nr;
+		char* save = NULL;
+		char* tok = strtok_r(line, " \t\r\n", &save);
+		if (!tok || tok[0] == '#')
+			continue;
+		if (farm->nr_jobs == cap) {
+			cap = cap ? 2 * cap : 256;
+			farm->jobs = realloc(farm->jobs, cap * sizeof(struct farm_job));
+		}
+		struct farm_job* job = &farm->jobs[farm->nr_jobs++];
+		*job = *defaults;
+		job->rom_file = strdup(tok);
+		while ((tok = strtok_r(NULL, " \t\r\n", &save))) {
+			unsigned int value;
+			if (sscanf(tok, "mcycles=%u", &value) == 1)
+				job->max_mcycles = value;
+			else if (sscanf(tok, "frames=%u", &value) == 1)
+				job->max_frames = value;
+			else if (sscanf(tok, "instrs=%u", &value) == 1)
+				job->max_instrs = value;
+			else {
+				fprintf(stderr, "Error: manifest line %d: unknown option %s\n", line_nr, tok);
+				free(line);
+				return false;
+			}
+		}
+	}
+	free(line);
+	return true;
+}
+
+static
+void farm_run_rom(const struct farm_job* job, struct farm_result* res) {
+	// pass / fail as reported on serial port by blargg test ROMs, else timeout at limits
+	res->status = "error";
+	size_t rom_size;
+	u8* rom_data = read_file(job->rom_file, &rom_size);
+	struct gameboy* gb = rom_data ? limeguy_create(rom_data, rom_size) : NULL;
+	free(rom_data);
+	if (!gb)
+		return;
+
+	unsigned int events = LIMEGUY_EVENT_SERIAL | LIMEGUY_EVENT_CYCLES;
+	if (job->max_frames)
+		events |= LIMEGUY_EVENT_VBLANK;
+	res->status = NULL;
+	while (!res->status) {
+		unsigned int budget = job->max_mcycles ? job->max_mcycles - limeguy_get_mcycles(gb) : UINT_MAX;
+		if (job->max_instrs && budget > FARM_INSTR_CHECK)
+			budget = FARM_INSTR_CHECK;
+		enum limeguy_event ev = limeguy_run_until(gb, events, budget);
+		if (ev == LIMEGUY_EVENT_STOP)
+			res->status = "stopped";
+		else if (ev == LIMEGUY_EVENT_SERIAL) {
+			if (res->serial_len < FARM_SERIAL_MAX) {
+				res->serial[res->serial_len++] = limeguy_get_serial_byte(gb);
+				res->serial[res->serial_len] = '\0';
+			}
+			if (strstr(res->serial, "Passed"))
+				res->status = "passed";
+			else if (strstr(res->serial, "Failed"))
+				res->status = "failed";
+		}
+		// VBLANK event is only there to check the frame limit
+		if (!res->status &&
+		    ((job->max_mcycles && limeguy_get_mcycles(gb) >= job->max_mcycles) ||
+		     (job->max_frames && limeguy_get_frame_count(gb) >= job->max_frames) ||
+		     (job->max_instrs && limeguy_get_instructions(gb) >= job->max_instrs)))
+			res->status = "timeout";
+	}
+
+	res->mcycles = limeguy_get_mcycles(gb);
+	res->frames = limeguy_get_frame_count(gb);
+	res->instrs = limeguy_get_instructions(gb);
+	u8 screen[LIMEGUY_SCREEN_WIDTH * LIMEGUY_SCREEN_HEIGHT];
+	limeguy_copy_screen(gb, screen);
+	res->screen_hash = 1469598103934665603ULL; // FNV-1a
+	for (int ii = 0; ii < (int)sizeof(screen); ++ii) {
+		res->screen_hash ^= screen[ii];
+		res->screen_hash *= 1099511628211ULL;
+	}
+	limeguy_destroy(gb);
+}
+
+static
+void write_json_string(FILE* out, const char* str) {
+	fputc('"', out);
+	for (const unsigned char* cc = (const unsigned char*)str; *cc; ++cc) {
+		if (*cc == '"' || *cc == '\\')
+			fprintf(out, "\\%c", *cc);
+		else if (*cc == '\n')
+			fputs("\\n", out);
+		else if (*cc < 0x20 || *cc >= 0x7F)
+			fprintf(out, "\\u%04x", *cc);
+		else
+			fputc(*cc, out);
+	}
+	fputc('"', out);
+}
+
+static
+void farm_task(void* ctx, int task, int worker) {
+	(void)worker;
+	struct farm* farm = ctx;
+	const struct farm_job* job = &farm->jobs[task];
+	struct farm_result res = {0};
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	farm_run_rom(job, &res);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	res.seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) * 1.0E-9;
+
+	pthread_mutex_lock(&farm->out_lock);
+	fprintf(farm->out, "{\"idx\":%d,\"rom\":", task);
+	write_json_string(farm->out, job->rom_file);
+	fprintf(farm->out, ",\"status\":\"%s\",\"mcycles\":%u,\"frames\":%u,\"instrs\":%u,\"time\":%.4f,\"screen\":\"%016llx\",\"serial\":",
+	        res.status, res.mcycles, res.frames, res.instrs, res.seconds, (unsigned long long)res.screen_hash);
+	write_json_string(farm->out, res.serial);
+	fprintf(farm->out, "}\n");
+	if (strcmp(res.status, "passed") == 0)
+		++farm->nr_passed;
+	else if (strcmp(res.status, "failed") == 0 || strcmp(res.status, "error") == 0)
+		++farm->nr_failed;
+	pthread_mutex_unlock(&farm->out_lock);
+}
+
+int main(int argc, char* argv[]) {
+	struct farm_job defaults = {.rom_file = NULL, .max_mcycles = FARM_DEFAULT_MCYCLES, .max_frames = 0, .max_instrs = 0};
+	int nr_threads = 0;
+	bool pin_cores = false;
+	const char* out_name = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "j:pm:f:i:o:h")) != -1) {
+		switch (opt) {
+			case 'j': nr_threads = atoi(optarg); break;
+			case 'p': pin_cores = true; break;
+			case 'm': defaults.max_mcycles = strtoul(optarg, NULL, 10); break;
+			case 'f': defaults.max_frames = strtoul(optarg, NULL, 10); break;
+			case 'i': defaults.max_instrs = strtoul(optarg, NULL, 10); break;
+			case 'o': out_name = optarg; break;
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	struct farm farm = {0};
+	FILE* manifest = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+	if (!manifest) {
+		fprintf(stderr, "Error: could not open manifest %s\n", argv[optind]);
+		return 1;
+	}
+	bool ok = parse_manifest(manifest, &farm, &defaults);
+	if (manifest != stdin)
+		fclose(manifest);
+	if (!ok)
+		return 1;
+	for (int ii = 0; ii < farm.nr_jobs; ++ii) {
+		const struct farm_job* job = &farm.jobs[ii];
+		if (!job->max_mcycles && !job->max_frames && !job->max_instrs) {
+			fprintf(stderr, "Error: no limits for %s\n", job->rom_file);
+			return 1;
+		}
+	}
+
+	farm.out = out_name ? fopen(out_name, "w") : stdout;
+	if (!farm.out) {
+		fprintf(stderr, "Error: could not open output file %s\n", out_name);
+		return 1;
+	}
+	pthread_mutex_init(&farm.out_lock, NULL);
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	struct threadpool* pool = threadpool_create(nr_threads, pin_cores);
+	if (!pool) {
+		fprintf(stderr, "Error: could not start worker threads\n");
+		return 1;
+	}
+	nr_threads = threadpool_get_nr_threads(pool);
+	threadpool_run(pool, farm_task, &farm, farm.nr_jobs);
+	threadpool_destroy(pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) * 1.0E-9;
+	fprintf(stderr, "%d ROMs: %d passed, %d failed, %d other; %.2fs on %d threads\n", farm.nr_jobs,
+	        farm.nr_passed, farm.nr_failed, farm.nr_jobs - farm.nr_passed - farm.nr_failed, elapsed, nr_threads);
+
+	// clean-up
+	if (farm.out != stdout)
+		fclose(farm.out);
+	pthread_mutex_destroy(&farm.out_lock);
+	for (int ii = 0; ii < farm.nr_jobs; ++ii)
+		free(farm.jobs[ii].rom_file);
+	free(farm.jobs);
+	return farm.nr_failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,69 @@
+#include <string.h>
+#include "framedelta.h"
+#include "ppu.h"
+
+static
+bool framedelta_line_is_off(const gb_color* line) {
+	return line[0] == COLOR_LCD_OFF; // LCD off blanks whole lines
+}
+
+int framedelta_encode(struct ppu* ppu, u8* out, bool keyframe) {
+	u32 lines_changed[LCD_CHANGED_WORDS];
+	ppu_take_changed_lines(ppu, PPU_LINES_FRAMEDELTA, lines_changed);
+
+	int size = 1;
+	int nr_ranges = 0;
+	u8* range = NULL; // header of open range
+	bool range_off = false;
+	for (int y = 0; y < LCD_HEIGHT; ++y) {
+		if (!keyframe && !((lines_changed[y / 32] >> (y % 32)) & 1)) {
+			range = NULL;
+			continue;
+		}
+		gb_color buf[LCD_WIDTH];
+		const gb_color* line = ppu_get_lcd_line(ppu, y, buf);
+		bool off = framedelta_line_is_off(line);
+		if (!range || off != range_off || (range[1] & ~FRAMEDELTA_OFF_FLAG) == FRAMEDELTA_MAX_RANGE) { // start new range
+			range = &out[size];
+			range[0] = y;
+			range[1] = off ? FRAMEDELTA_OFF_FLAG : 0;
+			range_off = off;
+			size += 2;
+			++nr_ranges;
+		}
+		++range[1];
+		if (off)
+			continue;
+		for (int ii = 0; ii < FRAMEDELTA_LINE_BYTES; ++ii, line += 4)
+			out[size++] = line[0] | (line[1] << 2) | (line[2] << 4) | (line[3] << 6);
+	}
+	out[0] = nr_ranges;
+	return size;
+}
+
+bool framedelta_decode(const u8* in, int size, gb_color screen[LCD_WIDTH * LCD_HEIGHT]) {
+	if (size < 1)
+		return false;
+	int pos = 1;
+	for (int r = 0; r < in[0]; ++r) {
+		if (pos + 2 > size)
+			return false;
+		int y = in[pos];
+		bool off = (in[pos + 1] & FRAMEDELTA_OFF_FLAG) != 0;
+		int nr_lines = in[pos + 1] & ~FRAMEDELTA_OFF_FLAG;
+		pos += 2;
+		if (y + nr_lines > LCD_HEIGHT || (!off && pos + nr_lines * FRAMEDELTA_LINE_BYTES > size))
+			return false;
+		gb_color* dest = &screen[y * LCD_WIDTH];
+		if (off) {
+			memset(dest, COLOR_LCD_OFF, nr_lines * LCD_WIDTH);
+			continue;
+		}
+		for (int ii = 0; ii < nr_lines * FRAMEDELTA_LINE_BYTES; ++ii) {
+			u8 b = in[pos++];
+			for (int px = 0; px < 4; ++px, b >>= 2)
+				*dest++ = b & 3;
+		}
+	}
+	return true;
+}
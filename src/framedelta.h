@@ -0,0 +1,26 @@
+#ifndef __FRAMEDELTA_H__
+#define __FRAMEDELTA_H__
+
+#include <stdbool.h>
+#include "common.h"
+#include "ppu.h"
+
+// Frame delta: screen lines changed since previous delta, for remote viewing and recording
+// (tracked apart from limeguy_take_changed_lines, both can be used on one instance).
+// Format:
+//   u8 nr_ranges
+//   per range: u8 first_line, u8 nr_lines (max 127; bit 7 set: LCD off, no pixel data)
+//              nr_lines * LCD_WIDTH / 4 bytes, 2 bits per pixel, leftmost pixel in lowest bits
+
+#define FRAMEDELTA_LINE_BYTES (LCD_WIDTH / 4)
+#define FRAMEDELTA_OFF_FLAG   0x80
+#define FRAMEDELTA_MAX_RANGE  0x7F
+#define FRAMEDELTA_MAX_SIZE   (1 + 2 * LCD_HEIGHT + LCD_HEIGHT * FRAMEDELTA_LINE_BYTES)
+
+// keyframe: include all lines. out holds FRAMEDELTA_MAX_SIZE bytes. Returns nr of bytes written
+// to out (at most FRAMEDELTA_MAX_SIZE)
+int framedelta_encode(struct ppu* ppu, u8* out, bool keyframe);
+// apply delta to screen (one gb_color per pixel). Returns false if delta is malformed
+bool framedelta_decode(const u8* in, int size, gb_color screen[LCD_WIDTH * LCD_HEIGHT]);
+
+#endif
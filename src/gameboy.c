@@ -1,52 +1,293 @@
+#define _GNU_SOURCE // aligned_alloc, memfd_create
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "gameboy.h"
 #include "cpu.h"
 #include "mcycle.h"
 #include "timers.h"
 #include "mem.h"
 #include "ppu.h"
+#include "instpool.h"
+
+#define STATE_MAGIC   0x5453474C /* "LGST" */
+#define STATE_VERSION 3 // increment when a saved struct changes
+
+// save state: header, then states of cpu, mem, timers, ppu, each starting on a cache line.
+// Fixed size and layout without pointers, so loading is a few straight copies
+struct gameboy_state_header {
+	u32 magic;
+	u32 version;
+	u32 size;
+	u32 rom_size;     // ROM the state belongs to
+	u32 rom_hash;
+	u32 rom_bank;
+};
+
+// arena copy in an anonymous file, children map it copy-on-write
+struct gameboy_snapshot {
+	int    fd;
+	size_t map_size; // arena size in whole pages
+};
+
+struct gameboy_state_layout {
+	size_t cpu;
+	size_t mem;
+	size_t timers;
+	size_t ppu;
+	size_t size;
+};
+
+// instance arena: one cache aligned block per gameboy, each part starting on its own cache
+// line. Parts used on every instruction first, ROM (read only, largest) last
+struct gameboy_layout {
+	size_t cpu;
+	size_t mcycle;
+	size_t timers;
+	size_t mem;
+	size_t ppu;
+	size_t rom;
+	size_t size;
+};
+
+static
+void gameboy_get_layout(struct gameboy_layout* layout, unsigned int rom_size) {
+	layout->cpu = CACHE_ALIGN(sizeof(struct gameboy));
+	layout->mcycle = layout->cpu + CACHE_ALIGN(sizeof(struct cpu));
+	layout->timers = layout->mcycle + CACHE_ALIGN(sizeof(struct mcycle));
+	layout->mem = layout->timers + CACHE_ALIGN(sizeof(struct timers));
+	layout->ppu = layout->mem + mem_arena_size();
+	layout->rom = layout->ppu + ppu_arena_size();
+	layout->size = layout->rom + rom_arena_size(rom_size);
+}
+
+static
+void gameboy_link(struct gameboy* gameboy, unsigned int rom_size) {
+	// point to parts in arena
+	struct gameboy_layout layout;
+	gameboy_get_layout(&layout, rom_size);
+	u8* arena = (u8*)gameboy;
+	gameboy->cpu = (struct cpu*)(arena + layout.cpu);
+	gameboy->mcycle = (struct mcycle*)(arena + layout.mcycle);
+	gameboy->timers = (struct timers*)(arena + layout.timers);
+	gameboy->mem = (struct mem*)(arena + layout.mem);
+	gameboy->ppu = (struct ppu*)(arena + layout.ppu);
+	gameboy->rom = (struct rom*)(arena + layout.rom);
+	gameboy->arena_size = layout.size;
+	gameboy->rom_size = rom_size;
+}
 
 struct gameboy* gameboy_create(const char* rom_file_name) {
 	// TODO: separate ROM insertion
-	struct gameboy* gameboy = malloc(sizeof(struct gameboy));
-	gameboy->button_state = 0;
+	unsigned int rom_size = 0;
+	u8* rom_data = rom_load_file(rom_file_name, &rom_size);
+	struct gameboy* gameboy = gameboy_create_from_buffer(rom_data, rom_size);
+	free(rom_data);
+	if (gameboy)
+		printf("Loaded ROM %s. Type: %02X\n", rom_file_name, rom_get_type(gameboy->rom));
+	return gameboy;
+}
+
+size_t gameboy_arena_size(unsigned int rom_size) {
+	struct gameboy_layout layout;
+	gameboy_get_layout(&layout, rom_size);
+	return layout.size;
+}
+
+static
+size_t gameboy_map_size(size_t arena_size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (arena_size + page - 1) / page * page;
+}
 
-	gameboy->rom = rom_create(rom_file_name);
-	if (!gameboy->rom || !gameboy->rom->data)
+static
+struct gameboy* gameboy_create_arena(struct instpool* pool, const void* rom_data, unsigned int rom_size) {
+	if (!rom_data || rom_size < 0x150) // needs at least a header
+		return NULL;
+	size_t size = gameboy_arena_size(rom_size);
+	struct gameboy* gameboy;
+	if (pool)
+		gameboy = size <= instpool_get_arena_size(pool) ? instpool_alloc(pool) : NULL;
+	else
+		gameboy = aligned_alloc(CACHE_LINE, size);
+	if (!gameboy)
 		return NULL;
-	printf("Loaded ROM %s. Type: %02X\n", rom_file_name, rom_get_type(gameboy->rom));
+	memset(gameboy, 0, size); // also reused pool arenas: nothing of an earlier instance remains
+	gameboy_link(gameboy, rom_size);
+	gameboy->pool = pool;
+	gameboy->mapped = false;
+	gameboy->button_state = 0;
+	gameboy->nr_breakpoints = 0;
+
+	rom_init(gameboy->rom, rom_data, rom_size);
 
-	gameboy->mem = mem_create();
+	mem_init(gameboy->mem);
 	mem_connect_rom(gameboy->mem, gameboy->rom);
 
-	gameboy->timers = timers_create(gameboy->mem);
+	timers_init(gameboy->timers, gameboy->mem);
 	gameboy->timers->count_div = 11; // pass mooneye boot_div-dmg0.gb
 
-	gameboy->ppu = ppu_create(gameboy->mem);
-	//gameboy->ppu = NULL;
+	ppu_init(gameboy->ppu, gameboy->mem);
+	mem_connect_ppu(gameboy->mem, gameboy->ppu);
 
-	struct mcycle* mcycle = mcycle_create(gameboy->timers, gameboy->ppu, gameboy->mem);
+	mcycle_init(gameboy->mcycle, gameboy->timers, gameboy->ppu, gameboy->mem);
 
-	gameboy->cpu = cpu_create(gameboy->mem, mcycle);
+	cpu_init(gameboy->cpu, gameboy->mem, gameboy->mcycle);
 	cpu_initregs_dmg0(gameboy->cpu);
-	
+
 	return gameboy;
 }
 
+struct gameboy* gameboy_create_from_buffer(const void* rom_data, unsigned int rom_size) {
+	return gameboy_create_arena(NULL, rom_data, rom_size);
+}
+
+struct gameboy* gameboy_create_in_pool(struct instpool* pool, const void* rom_data, unsigned int rom_size) {
+	return gameboy_create_arena(pool, rom_data, rom_size);
+}
+
 void gameboy_destroy(struct gameboy* gameboy) {
 	if (gameboy) {
-		rom_destroy(gameboy->rom);
-		mem_destroy(gameboy->mem);
-		timers_destroy(gameboy->timers);
-		ppu_destroy(gameboy->ppu);
-		mcycle_destroy(gameboy->mcycle);
-		cpu_destroy(gameboy->cpu);
-		free(gameboy);
+		mem_deinit(gameboy->mem);
+		ppu_deinit(gameboy->ppu);
+		if (gameboy->mapped)
+			munmap(gameboy, gameboy_map_size(gameboy->arena_size));
+		else if (gameboy->pool)
+			instpool_free(gameboy->pool, gameboy);
+		else
+			free(gameboy); // whole arena
+	}
+}
+
+void gameboy_relink(struct gameboy* gameboy) {
+	gameboy_link(gameboy, gameboy->rom_size);
+	gameboy->pool = NULL;
+	gameboy->mapped = false;
+	rom_relink(gameboy->rom);
+	mem_relink(gameboy->mem);
+	mem_connect_rom(gameboy->mem, gameboy->rom);
+	mem_connect_ppu(gameboy->mem, gameboy->ppu);
+	gameboy->timers->mem = gameboy->mem;
+	ppu_relink(gameboy->ppu, gameboy->mem);
+	mcycle_init(gameboy->mcycle, gameboy->timers, gameboy->ppu, gameboy->mem);
+	gameboy->cpu->mem = gameboy->mem;
+	gameboy->cpu->mcycle = gameboy->mcycle;
+}
+
+struct gameboy_snapshot* gameboy_snapshot_create(struct gameboy* gameboy) {
+	ppu_render_sync(gameboy->ppu); // LCD complete
+	struct gameboy_snapshot* snapshot = malloc(sizeof(struct gameboy_snapshot));
+	snapshot->map_size = gameboy_map_size(gameboy->arena_size);
+	snapshot->fd = memfd_create("limeguy-snapshot", MFD_CLOEXEC);
+	if (snapshot->fd < 0 || ftruncate(snapshot->fd, snapshot->map_size) != 0) {
+		gameboy_snapshot_destroy(snapshot);
+		return NULL;
+	}
+	void* copy = mmap(NULL, snapshot->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, snapshot->fd, 0);
+	if (copy == MAP_FAILED) {
+		gameboy_snapshot_destroy(snapshot);
+		return NULL;
 	}
+	memcpy(copy, gameboy, gameboy->arena_size);
+	munmap(copy, snapshot->map_size);
+	return snapshot;
+}
+
+void gameboy_snapshot_destroy(struct gameboy_snapshot* snapshot) {
+	if (!snapshot)
+		return;
+	if (snapshot->fd >= 0)
+		close(snapshot->fd); // file lives on while children map it
+	free(snapshot);
+}
+
+struct gameboy* gameboy_fork(struct gameboy_snapshot* snapshot) {
+	void* arena = mmap(NULL, snapshot->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, snapshot->fd, 0);
+	if (arena == MAP_FAILED)
+		return NULL;
+	struct gameboy* gameboy = arena;
+	gameboy_relink(gameboy);
+	gameboy->mapped = true;
+	return gameboy;
 }
 
 void gameboy_set_button(struct gameboy* gameboy, enum gb_button but, bool pressed) {
 	mem_set_button(gameboy->mem, but, pressed);
 }
 
+void gameboy_set_buttons(struct gameboy* gameboy, u8 buttons) {
+	mem_set_buttons(gameboy->mem, buttons);
+}
+
+static
+void gameboy_get_state_layout(struct gameboy_state_layout* layout) {
+	layout->cpu = CACHE_ALIGN(sizeof(struct gameboy_state_header));
+	layout->mem = layout->cpu + CACHE_ALIGN(cpu_state_size());
+	layout->timers = layout->mem + CACHE_ALIGN(mem_state_size());
+	layout->ppu = layout->timers + CACHE_ALIGN(timers_state_size());
+	layout->size = layout->ppu + CACHE_ALIGN(ppu_state_size());
+}
+
+size_t gameboy_state_size(void) {
+	struct gameboy_state_layout layout;
+	gameboy_get_state_layout(&layout);
+	return layout.size;
+}
+
+void gameboy_save_state(struct gameboy* gameboy, void* buf) {
+	struct gameboy_state_layout layout;
+	gameboy_get_state_layout(&layout);
+	struct gameboy_state_header header = {
+		.magic = STATE_MAGIC,
+		.version = STATE_VERSION,
+		.size = layout.size,
+		.rom_size = gameboy->rom_size,
+		.rom_hash = rom_get_hash(gameboy->rom),
+		.rom_bank = gameboy->rom->bank
+	};
+	u8* dest = buf;
+	memcpy(dest, &header, sizeof(header));
+	cpu_save_state(gameboy->cpu, dest + layout.cpu);
+	mem_save_state(gameboy->mem, dest + layout.mem);
+	timers_save_state(gameboy->timers, dest + layout.timers);
+	ppu_save_state(gameboy->ppu, dest + layout.ppu);
+
+	// padding between parts zeroed too (parts are zeroed at create): same state, same bytes
+	memset(dest + sizeof(header), 0, layout.cpu - sizeof(header));
+	memset(dest + layout.cpu + cpu_state_size(), 0, layout.mem - layout.cpu - cpu_state_size());
+	memset(dest + layout.mem + mem_state_size(), 0, layout.timers - layout.mem - mem_state_size());
+	memset(dest + layout.timers + timers_state_size(), 0, layout.ppu - layout.timers - timers_state_size());
+	memset(dest + layout.ppu + ppu_state_size(), 0, layout.size - layout.ppu - ppu_state_size());
+}
+
+bool gameboy_load_state(struct gameboy* gameboy, const void* buf, size_t size) {
+	struct gameboy_state_layout layout;
+	gameboy_get_state_layout(&layout);
+	struct gameboy_state_header header;
+	if (size != layout.size)
+		return false;
+	memcpy(&header, buf, sizeof(header));
+	if (header.magic != STATE_MAGIC || header.version != STATE_VERSION || header.size != size)
+		return false;
+	if (header.rom_size != gameboy->rom_size || header.rom_hash != rom_get_hash(gameboy->rom))
+		return false; // other game
+	if (header.rom_bank >= rom_get_nr_banks(gameboy->rom))
+		return false;
+
+	// render thread works on copy of VRAM: restart it with the new one
+	bool render_thread = gameboy->ppu->render_thread != NULL;
+	ppu_stop_render_thread(gameboy->ppu);
+
+	const u8* src = buf;
+	gameboy->rom->bank = header.rom_bank;
+	cpu_load_state(gameboy->cpu, src + layout.cpu);
+	mem_load_state(gameboy->mem, src + layout.mem);
+	timers_load_state(gameboy->timers, src + layout.timers);
+	ppu_load_state(gameboy->ppu, src + layout.ppu);
+
+	if (render_thread)
+		ppu_start_render_thread(gameboy->ppu);
+	return true;
+}
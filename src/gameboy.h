@@ -10,37 +10,62 @@
 */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "common.h"
 
+#define GAMEBOY_MAX_BREAKPOINTS 16
+
+// all parts of a gameboy are in one allocation (arena) that starts with struct gameboy,
+// see gameboy.c
 struct gameboy {
-	struct rom*    rom;
-	struct mem*    mem;
+	struct cpu*    cpu;
+	struct mcycle* mcycle;
 	struct timers* timers;
+	struct mem*    mem;
 	struct ppu*    ppu;
-	struct mcycle* mcycle;
-	struct cpu*    cpu;
+	struct rom*    rom;
+	size_t         arena_size; // bytes
+	unsigned int   rom_size;
+	struct instpool* pool;     // arena taken from, NULL: own allocation
+	bool           mapped;     // arena is a private mapping of a snapshot (gameboy_fork)
 
 	u8             button_state; // as opposed to GB, a 1-bit means pressed
-};
 
-enum gb_button { // correspond to bit nrs in button_state
-	BUT_RIGHT = 0,
-	BUT_LEFT,
-	BUT_UP,
-	BUT_DOWN,
-	BUT_A,
-	BUT_B,
-	BUT_SELECT,
-	BUT_START
+	// breakpoints (PC), checked by limeguy_run_until
+	u16            breakpoints[GAMEBOY_MAX_BREAKPOINTS];
+	int            nr_breakpoints;
 };
 
 struct gameboy* gameboy_create(const char* rom_file_name);
+struct gameboy* gameboy_create_from_buffer(const void* rom_data, unsigned int rom_size); // copies ROM
+// arena from pool (see instpool.h), NULL if ROM doesn't fit its arena size
+struct gameboy* gameboy_create_in_pool(struct instpool* pool, const void* rom_data, unsigned int rom_size);
 void gameboy_destroy(struct gameboy* gameboy);
+size_t gameboy_arena_size(unsigned int rom_size);
+// arena was copied to another address (arena_size bytes): make the copy point to itself.
+// Host resources (render thread, output, memory watches, RAM samples) stay with the original
+void gameboy_relink(struct gameboy* gameboy);
+
+// copy-on-write children, e.g. for tree search: a snapshot copies the arena once into an
+// anonymous file (memfd), each fork maps that file privately. Children share its pages until
+// they write to them, so a fork costs a mapping and a few page copies for the pointers.
+// Children start without host resources (as gameboy_relink), outlive the snapshot and are
+// destroyed with gameboy_destroy. NULL on error
+struct gameboy_snapshot* gameboy_snapshot_create(struct gameboy* gameboy);
+void gameboy_snapshot_destroy(struct gameboy_snapshot* snapshot);
+struct gameboy* gameboy_fork(struct gameboy_snapshot* snapshot);
 
 /*
 u8 gameboy_get_ssba_buttons(struct gameboy* gameboy);
 u8 gameboy_get_dpad_buttons(struct gameboy* gameboy);
 */
 void gameboy_set_button(struct gameboy* gameboy, enum gb_button but, bool pressed);
+void gameboy_set_buttons(struct gameboy* gameboy, u8 buttons); // all at once, see enum gb_button
+
+// save state: buf holds gameboy_state_size() bytes. Versioned, fixed layout, no pointers.
+// Loading fails for a state of another version or ROM
+size_t gameboy_state_size(void);
+void gameboy_save_state(struct gameboy* gameboy, void* buf);
+bool gameboy_load_state(struct gameboy* gameboy, const void* buf, size_t size);
 
 #endif
@@ -0,0 +1,182 @@
+#define _GNU_SOURCE // MAP_HUGETLB, syscall
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "instpool.h"
+#include "common.h"
+
+#define MPOL_PREFERRED 1 // from numaif.h, without depending on libnuma
+
+struct instpool_slab {
+	u8*                   mem;
+	size_t                size;
+	bool                  huge; // hugetlbfs pages
+	struct instpool_slab* next;
+};
+
+// cache line in front of each arena
+struct instpool_slot {
+	struct instpool_slot* next; // free list
+	int                   node; // NUMA node the arena is placed on
+};
+
+// arenas of one NUMA node
+struct instpool_node {
+	pthread_mutex_t       lock;
+	struct instpool_slot* free_list; // freed arenas
+	u8*                   unused;    // rest of newest slab, never handed out yet
+	u8*                   unused_end;
+	struct instpool_slab* slabs;
+} __attribute__((aligned(64))); // locked by different workers
+
+struct instpool {
+	size_t               arena_size;
+	size_t               slot_size; // arena and its header
+	size_t               slab_size;
+	int                  nr_slabs;
+	int                  nr_huge;
+	struct instpool_node nodes[INSTPOOL_MAX_NODES];
+};
+
+struct instpool* instpool_create(size_t arena_size) {
+	if (!arena_size)
+		return NULL;
+	struct instpool* pool = aligned_alloc(64, sizeof(struct instpool));
+	if (!pool)
+		return NULL;
+	memset(pool, 0, sizeof(struct instpool));
+	pool->arena_size = CACHE_ALIGN(arena_size);
+	pool->slot_size = CACHE_ALIGN(sizeof(struct instpool_slot)) + pool->arena_size;
+	// large ROMs: slab holds at least one arena
+	pool->slab_size = (pool->slot_size + INSTPOOL_SLAB_SIZE - 1) & ~(size_t)(INSTPOOL_SLAB_SIZE - 1);
+	for (int ii = 0; ii < INSTPOOL_MAX_NODES; ++ii)
+		pthread_mutex_init(&pool->nodes[ii].lock, NULL);
+	return pool;
+}
+
+void instpool_destroy(struct instpool* pool) {
+	if (!pool)
+		return;
+	for (int ii = 0; ii < INSTPOOL_MAX_NODES; ++ii) {
+		struct instpool_node* node = &pool->nodes[ii];
+		while (node->slabs) {
+			struct instpool_slab* slab = node->slabs;
+			node->slabs = slab->next;
+			munmap(slab->mem, slab->size);
+			free(slab);
+		}
+		pthread_mutex_destroy(&node->lock);
+	}
+	free(pool);
+}
+
+size_t instpool_get_arena_size(struct instpool* pool) {
+	return pool->arena_size;
+}
+
+int instpool_get_nr_slabs(struct instpool* pool, int* nr_huge) {
+	if (nr_huge)
+		*nr_huge = __atomic_load_n(&pool->nr_huge, __ATOMIC_RELAXED);
+	return __atomic_load_n(&pool->nr_slabs, __ATOMIC_RELAXED);
+}
+
+static
+int instpool_current_node(void) {
+	unsigned int cpu = 0, node = 0;
+#ifdef SYS_getcpu
+	if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+		node = 0;
+#endif
+	return node < INSTPOOL_MAX_NODES ? (int)node : 0;
+}
+
+static
+u8* instpool_map(size_t size, bool* huge) {
+	// reserved huge pages (hugetlbfs) if the admin set some up
+	*huge = true;
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mem != MAP_FAILED)
+		return mem;
+
+	// else normal pages, 2 MB aligned so the kernel can back them with transparent huge pages
+	*huge = false;
+	size_t map_size = size + INSTPOOL_SLAB_SIZE;
+	u8* raw = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (raw == MAP_FAILED)
+		return NULL;
+	u8* start = (u8*)(((uintptr_t)raw + INSTPOOL_SLAB_SIZE - 1) & ~(uintptr_t)(INSTPOOL_SLAB_SIZE - 1));
+	if (start > raw)
+		munmap(raw, start - raw);
+	if (start + size < raw + map_size)
+		munmap(start + size, raw + map_size - (start + size));
+#ifdef MADV_HUGEPAGE
+	madvise(start, size, MADV_HUGEPAGE); // hint only, THP may be off
+#endif
+	return start;
+}
+
+static
+bool instpool_add_slab(struct instpool* pool, struct instpool_node* node, int node_idx) {
+	struct instpool_slab* slab = malloc(sizeof(struct instpool_slab));
+	if (!slab)
+		return false;
+	slab->size = pool->slab_size;
+	slab->mem = instpool_map(slab->size, &slab->huge);
+	if (!slab->mem) {
+		free(slab);
+		return false;
+	}
+#ifdef SYS_mbind
+	// pages on this node before first touch. Preferred, not bound: other nodes when it is full.
+	// Fails without NUMA support, then first touch (by this thread) places them
+	unsigned long mask[INSTPOOL_MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+	mask[node_idx / (8 * sizeof(unsigned long))] = 1ul << (node_idx % (8 * sizeof(unsigned long)));
+	syscall(SYS_mbind, slab->mem, slab->size, MPOL_PREFERRED, mask, INSTPOOL_MAX_NODES + 1, 0);
+#else
+	(void)node_idx;
+#endif
+	slab->next = node->slabs;
+	node->slabs = slab;
+	node->unused = slab->mem;
+	node->unused_end = slab->mem + slab->size;
+	__atomic_add_fetch(&pool->nr_slabs, 1, __ATOMIC_RELAXED);
+	if (slab->huge)
+		__atomic_add_fetch(&pool->nr_huge, 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+void* instpool_alloc(struct instpool* pool) {
+	int node_idx = instpool_current_node();
+	struct instpool_node* node = &pool->nodes[node_idx];
+	struct instpool_slot* slot = NULL;
+	pthread_mutex_lock(&node->lock);
+	if (node->free_list) {
+		slot = node->free_list;
+		node->free_list = slot->next;
+	}
+	else if ((size_t)(node->unused_end - node->unused) >= pool->slot_size ||
+	         instpool_add_slab(pool, node, node_idx)) {
+		slot = (struct instpool_slot*)node->unused;
+		slot->node = node_idx;
+		node->unused += pool->slot_size;
+	}
+	pthread_mutex_unlock(&node->lock);
+	return slot ? (u8*)slot + CACHE_ALIGN(sizeof(struct instpool_slot)) : NULL;
+}
+
+void instpool_free(struct instpool* pool, void* arena) {
+	if (!arena)
+		return;
+	// back to the node it was placed on, not the one of the caller
+	struct instpool_slot* slot = (struct instpool_slot*)((u8*)arena - CACHE_ALIGN(sizeof(struct instpool_slot)));
+	struct instpool_node* node = &pool->nodes[slot->node];
+	pthread_mutex_lock(&node->lock);
+	slot->next = node->free_list;
+	node->free_list = slot;
+	pthread_mutex_unlock(&node->lock);
+}
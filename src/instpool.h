@@ -0,0 +1,33 @@
+#ifndef __INSTPOOL_H__
+#define __INSTPOOL_H__
+
+#include <stddef.h>
+
+// Pool of instance arenas (see gameboy.c) of one size, for hosts running thousands of
+// instances. Arenas are carved out of 2 MB slabs, backed by huge pages when the system has
+// them (hugetlbfs, else transparent huge pages). Each NUMA node has its own slabs and free
+// list: an arena comes from the node of the calling thread, so create instances on the
+// worker thread that will run them (pinned, else the node is the one of the core it happens to
+// be on). Each arena has a cache line header in front holding its node: freed arenas go back to
+// the free list of that node and are reused by the next alloc on it. Contents are not cleared
+
+#define INSTPOOL_SLAB_SIZE (2u << 20)
+#define INSTPOOL_MAX_NODES 64
+
+struct instpool;
+
+// arena_size: largest arena taken from the pool
+struct instpool* instpool_create(size_t arena_size);
+// after all arenas are freed
+void instpool_destroy(struct instpool* pool);
+
+size_t instpool_get_arena_size(struct instpool* pool);
+// cache aligned arena of instpool_get_arena_size() bytes, NULL: out of memory
+void* instpool_alloc(struct instpool* pool);
+void instpool_free(struct instpool* pool, void* arena);
+
+// slabs mapped so far. nr_huge (may be NULL): how many of them are on hugetlbfs pages,
+// transparent huge pages are not counted
+int instpool_get_nr_slabs(struct instpool* pool, int* nr_huge);
+
+#endif
@@ -0,0 +1,221 @@
+#include <string.h>
+#include "limeguy.h"
+#include "gameboy.h"
+#include "cpu.h"
+#include "mem.h"
+#include "ppu.h"
+#include "instpool.h"
+
+// public enums --> internal ones
+static const enum gb_button limeguy_buttons[8] = {
+	[LIMEGUY_BUTTON_RIGHT]  = BUT_RIGHT,
+	[LIMEGUY_BUTTON_LEFT]   = BUT_LEFT,
+	[LIMEGUY_BUTTON_UP]     = BUT_UP,
+	[LIMEGUY_BUTTON_DOWN]   = BUT_DOWN,
+	[LIMEGUY_BUTTON_A]      = BUT_A,
+	[LIMEGUY_BUTTON_B]      = BUT_B,
+	[LIMEGUY_BUTTON_SELECT] = BUT_SELECT,
+	[LIMEGUY_BUTTON_START]  = BUT_START
+};
+
+static const enum ppu_pixel_format limeguy_pixel_formats[] = {
+	[LIMEGUY_PIXFMT_RGBA8888] = PPU_PIXFMT_RGBA8888,
+	[LIMEGUY_PIXFMT_BGRA8888] = PPU_PIXFMT_BGRA8888,
+	[LIMEGUY_PIXFMT_RGB565]   = PPU_PIXFMT_RGB565,
+	[LIMEGUY_PIXFMT_GRAY8]    = PPU_PIXFMT_GRAY8
+};
+
+struct gameboy* limeguy_create(const void* rom_data, size_t rom_size) {
+	return gameboy_create_from_buffer(rom_data, rom_size);
+}
+
+void limeguy_destroy(struct gameboy* gb) {
+	gameboy_destroy(gb);
+}
+
+struct instpool* limeguy_pool_create(size_t max_rom_size) {
+	return instpool_create(gameboy_arena_size(max_rom_size));
+}
+
+void limeguy_pool_destroy(struct instpool* pool) {
+	instpool_destroy(pool);
+}
+
+struct gameboy* limeguy_create_in_pool(struct instpool* pool, const void* rom_data, size_t rom_size) {
+	return gameboy_create_in_pool(pool, rom_data, rom_size);
+}
+
+struct gameboy_snapshot* limeguy_snapshot_create(struct gameboy* gb) {
+	return gameboy_snapshot_create(gb);
+}
+
+void limeguy_snapshot_destroy(struct gameboy_snapshot* snapshot) {
+	gameboy_snapshot_destroy(snapshot);
+}
+
+struct gameboy* limeguy_fork(struct gameboy_snapshot* snapshot) {
+	return gameboy_fork(snapshot);
+}
+
+void limeguy_step(struct gameboy* gb) {
+	cpu_run_instruction(gb->cpu);
+}
+
+void limeguy_run_frame(struct gameboy* gb) {
+	limeguy_run_until(gb, LIMEGUY_EVENT_VBLANK, 0);
+}
+
+static
+bool limeguy_at_breakpoint(struct gameboy* gb) {
+	for (int ii = 0; ii < gb->nr_breakpoints; ++ii)
+		if (gb->breakpoints[ii] == gb->cpu->PC)
+			return true;
+	return false;
+}
+
+enum limeguy_event limeguy_run_until(struct gameboy* gb, unsigned int event_mask, unsigned int max_mcycles) {
+	struct cpu* cpu = gb->cpu;
+	unsigned int start_mcycles = cpu->nr_mcycles;
+	unsigned int vblanks = gb->ppu->nr_vblanks;
+	unsigned int serial_count = gb->mem->serial_count;
+	mem_watch_hit(gb->mem, NULL); // forget hits from before
+	for (;;) {
+		if (cpu_is_stopped(cpu))
+			return LIMEGUY_EVENT_STOP;
+		cpu_run_instruction(cpu);
+		if ((event_mask & LIMEGUY_EVENT_BREAKPOINT) && limeguy_at_breakpoint(gb))
+			return LIMEGUY_EVENT_BREAKPOINT;
+		if (mem_watch_hit(gb->mem, NULL) && (event_mask & LIMEGUY_EVENT_WATCH))
+			return LIMEGUY_EVENT_WATCH;
+		if ((event_mask & LIMEGUY_EVENT_SERIAL) && gb->mem->serial_count != serial_count)
+			return LIMEGUY_EVENT_SERIAL;
+		if ((event_mask & LIMEGUY_EVENT_VBLANK) && gb->ppu->nr_vblanks != vblanks) {
+			ppu_render_sync(gb->ppu);
+			return LIMEGUY_EVENT_VBLANK;
+		}
+		if ((event_mask & LIMEGUY_EVENT_CYCLES) && cpu->nr_mcycles - start_mcycles >= max_mcycles)
+			return LIMEGUY_EVENT_CYCLES;
+	}
+}
+
+bool limeguy_add_breakpoint(struct gameboy* gb, u16 pc) {
+	if (gb->nr_breakpoints == GAMEBOY_MAX_BREAKPOINTS)
+		return false;
+	gb->breakpoints[gb->nr_breakpoints++] = pc;
+	return true;
+}
+
+void limeguy_remove_breakpoint(struct gameboy* gb, u16 pc) {
+	for (int ii = 0; ii < gb->nr_breakpoints; ++ii) {
+		if (gb->breakpoints[ii] == pc)
+			gb->breakpoints[ii--] = gb->breakpoints[--gb->nr_breakpoints];
+	}
+}
+
+void limeguy_set_watch(struct gameboy* gb, u16 addr, bool watch) {
+	mem_set_watch(gb->mem, addr, watch);
+}
+
+u16 limeguy_get_watch_addr(struct gameboy* gb) {
+	return gb->mem->watch_addr;
+}
+
+u8 limeguy_get_serial_byte(struct gameboy* gb) {
+	return gb->mem->serial_byte;
+}
+
+void limeguy_set_serial_echo(struct gameboy* gb, bool echo) {
+	gb->mem->serial_echo = echo;
+}
+
+bool limeguy_is_stopped(struct gameboy* gb) {
+	return cpu_is_stopped(gb->cpu);
+}
+
+unsigned int limeguy_get_mcycles(struct gameboy* gb) {
+	return gb->cpu->nr_mcycles;
+}
+
+unsigned int limeguy_get_instructions(struct gameboy* gb) {
+	return gb->cpu->nr_instructions;
+}
+
+unsigned int limeguy_get_frame_count(struct gameboy* gb) {
+	return gb->ppu->nr_frames;
+}
+
+void limeguy_set_button(struct gameboy* gb, enum limeguy_button button, bool pressed) {
+	gameboy_set_button(gb, limeguy_buttons[button & 7], pressed);
+}
+
+void limeguy_set_buttons(struct gameboy* gb, u8 buttons) {
+	u8 mask = 0;
+	for (int ii = 0; ii < 8; ++ii) {
+		if ((buttons >> ii) & 1)
+			mask |= 1 << limeguy_buttons[ii];
+	}
+	gameboy_set_buttons(gb, mask);
+}
+
+void limeguy_copy_screen(struct gameboy* gb, u8 dest[LIMEGUY_SCREEN_WIDTH * LIMEGUY_SCREEN_HEIGHT]) {
+	ppu_render_sync(gb->ppu);
+	for (int y = 0; y < LCD_HEIGHT; ++y) {
+		gb_color buf[LCD_WIDTH];
+		memcpy(&dest[y * LCD_WIDTH], ppu_get_lcd_line(gb->ppu, y, buf), LCD_WIDTH);
+	}
+}
+
+void limeguy_set_output(struct gameboy* gb, void* pixels, int pitch, enum limeguy_pixel_format format,
+                        struct limeguy_color palette[5]) {
+	struct rgba_color colors[5];
+	for (int ii = 0; ii < 5; ++ii)
+		colors[ii] = (struct rgba_color){palette[ii].r, palette[ii].g, palette[ii].b, palette[ii].a};
+	ppu_set_output(gb->ppu, pixels, pitch, limeguy_pixel_formats[format], colors);
+}
+
+void limeguy_swap_output(struct gameboy* gb, void* pixels, const u32 stale_lines[LIMEGUY_LINE_WORDS]) {
+	ppu_swap_output(gb->ppu, pixels, stale_lines);
+}
+
+void limeguy_take_changed_lines(struct gameboy* gb, u32 lines[LIMEGUY_LINE_WORDS]) {
+	ppu_take_changed_lines(gb->ppu, PPU_LINES_FRONT_END, lines);
+}
+
+u8 limeguy_read(struct gameboy* gb, u16 addr) {
+	return mem_read(gb->mem, addr);
+}
+
+void limeguy_write(struct gameboy* gb, u16 addr, u8 value) {
+	mem_write(gb->mem, addr, value);
+}
+
+bool limeguy_set_ram_samples(struct gameboy* gb, const u16* addrs, const u8* widths, int nr_addrs, int nr_slots) {
+	return mem_set_samples(gb->mem, addrs, widths, nr_addrs, nr_slots);
+}
+
+int limeguy_get_ram_sample_size(struct gameboy* gb) {
+	return gb->mem->samples ? gb->mem->samples->sample_size : 0;
+}
+
+unsigned int limeguy_get_ram_sample_count(struct gameboy* gb) {
+	return gb->mem->samples ? gb->mem->samples->nr_taken : 0;
+}
+
+bool limeguy_get_ram_sample(struct gameboy* gb, unsigned int nr, void* data, u8* changed, unsigned int* frame) {
+	return mem_get_sample(gb->mem, nr, data, changed, frame);
+}
+
+size_t limeguy_state_size(void) {
+	return gameboy_state_size();
+}
+
+bool limeguy_save_state(struct gameboy* gb, void* buf, size_t size) {
+	if (size < gameboy_state_size())
+		return false;
+	gameboy_save_state(gb, buf);
+	return true;
+}
+
+bool limeguy_load_state(struct gameboy* gb, const void* buf, size_t size) {
+	return gameboy_load_state(gb, buf, size);
+}
@@ -0,0 +1,138 @@
+#ifndef __LIMEGUY_H__
+#define __LIMEGUY_H__
+
+// libgameboy: headless emulator core (no raylib). The gameboy is an opaque handle,
+// everything goes through the functions below
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LIMEGUY_API_VERSION 1
+
+#define LIMEGUY_SCREEN_WIDTH  160
+#define LIMEGUY_SCREEN_HEIGHT 144
+#define LIMEGUY_LINE_WORDS    ((LIMEGUY_SCREEN_HEIGHT + 31) / 32) // bit per screen line
+
+struct gameboy;
+struct instpool;
+struct gameboy_snapshot;
+
+enum limeguy_button { // bit nrs in button masks
+	LIMEGUY_BUTTON_RIGHT = 0,
+	LIMEGUY_BUTTON_LEFT,
+	LIMEGUY_BUTTON_UP,
+	LIMEGUY_BUTTON_DOWN,
+	LIMEGUY_BUTTON_A,
+	LIMEGUY_BUTTON_B,
+	LIMEGUY_BUTTON_SELECT,
+	LIMEGUY_BUTTON_START
+};
+
+// pixel formats for limeguy_set_output
+enum limeguy_pixel_format {
+	LIMEGUY_PIXFMT_RGBA8888, // bytes R, G, B, A
+	LIMEGUY_PIXFMT_BGRA8888, // bytes B, G, R, A
+	LIMEGUY_PIXFMT_RGB565,   // 16 bit, native endianness
+	LIMEGUY_PIXFMT_GRAY8     // 8 bit luminance
+};
+
+struct limeguy_color {
+	uint8_t r;
+	uint8_t g;
+	uint8_t b;
+	uint8_t a;
+};
+
+// ROM data is copied. Returns NULL on error
+struct gameboy* limeguy_create(const void* rom_data, size_t rom_size);
+void limeguy_destroy(struct gameboy* gb);
+
+// many instances: arenas from a pool of huge page slabs, local to the NUMA node of the
+// creating thread (see instpool.h). Pool for ROMs up to max_rom_size, destroy it after its
+// instances. Instances are destroyed with limeguy_destroy() as usual
+struct instpool* limeguy_pool_create(size_t max_rom_size);
+void limeguy_pool_destroy(struct instpool* pool);
+struct gameboy* limeguy_create_in_pool(struct instpool* pool, const void* rom_data, size_t rom_size);
+
+// branching (tree search): children of a snapshot share its memory pages copy-on-write until
+// they write to them. Snapshot once per branch point, fork each child from it. Children are
+// independent instances without output, watches or RAM samples, destroyed with
+// limeguy_destroy() (also after the snapshot). NULL on error
+struct gameboy_snapshot* limeguy_snapshot_create(struct gameboy* gb);
+void limeguy_snapshot_destroy(struct gameboy_snapshot* snapshot);
+struct gameboy* limeguy_fork(struct gameboy_snapshot* snapshot);
+
+// run
+void limeguy_step(struct gameboy* gb);      // one instruction
+void limeguy_run_frame(struct gameboy* gb); // until next vblank (LCD off: one frame of cycles)
+bool limeguy_is_stopped(struct gameboy* gb);
+unsigned int limeguy_get_mcycles(struct gameboy* gb);
+unsigned int limeguy_get_instructions(struct gameboy* gb);
+unsigned int limeguy_get_frame_count(struct gameboy* gb);
+
+// run until one of the events in mask happens, returns the event that stopped emulation.
+// Events are checked after every instruction, in enum order. STOP is always reported
+enum limeguy_event {
+	LIMEGUY_EVENT_STOP       = 1 << 0, // CPU stopped
+	LIMEGUY_EVENT_BREAKPOINT = 1 << 1, // PC at breakpoint
+	LIMEGUY_EVENT_WATCH      = 1 << 2, // watched address written
+	LIMEGUY_EVENT_SERIAL     = 1 << 3, // byte sent on serial port
+	LIMEGUY_EVENT_VBLANK     = 1 << 4, // vblank started (LCD off: frame time passed)
+	LIMEGUY_EVENT_CYCLES     = 1 << 5  // max_mcycles passed
+};
+enum limeguy_event limeguy_run_until(struct gameboy* gb, unsigned int event_mask, unsigned int max_mcycles);
+
+bool limeguy_add_breakpoint(struct gameboy* gb, uint16_t pc); // false: too many
+void limeguy_remove_breakpoint(struct gameboy* gb, uint16_t pc);
+// echo RAM E000 - FDFF is watched and reported as C000 - DDFF
+void limeguy_set_watch(struct gameboy* gb, uint16_t addr, bool watch);
+uint16_t limeguy_get_watch_addr(struct gameboy* gb);  // address written, after LIMEGUY_EVENT_WATCH
+uint8_t limeguy_get_serial_byte(struct gameboy* gb); // last byte sent
+void limeguy_set_serial_echo(struct gameboy* gb, bool echo); // print serial bytes to stdout (default: off)
+
+// input
+void limeguy_set_button(struct gameboy* gb, enum limeguy_button button, bool pressed);
+void limeguy_set_buttons(struct gameboy* gb, uint8_t buttons); // bit (1 << enum limeguy_button) set: pressed
+
+// video. Screen colors: 0 .. 3, 4 is LCD off
+// screen: 160 x 144, one byte per pixel
+void limeguy_copy_screen(struct gameboy* gb, uint8_t dest[LIMEGUY_SCREEN_WIDTH * LIMEGUY_SCREEN_HEIGHT]);
+// PPU writes finished lines straight into pixels. palette: colors 0 .. 3, LCD off. pixels NULL: none
+void limeguy_set_output(struct gameboy* gb, void* pixels, int pitch, enum limeguy_pixel_format format,
+                        struct limeguy_color palette[5]);
+// multiple buffering without converting whole frames: output into other pixels, with pitch,
+// format and palette of limeguy_set_output. Only lines set in stale_lines are converted, the
+// rest must be up to date already (bit y % 32 of word y / 32)
+void limeguy_swap_output(struct gameboy* gb, void* pixels, const uint32_t stale_lines[LIMEGUY_LINE_WORDS]);
+// screen lines changed since previous call (or load state), same bits as above. Not affected by
+// frame delta encoding
+void limeguy_take_changed_lines(struct gameboy* gb, uint32_t lines[LIMEGUY_LINE_WORDS]);
+
+// memory, as seen by the CPU
+uint8_t limeguy_read(struct gameboy* gb, uint16_t addr);
+void limeguy_write(struct gameboy* gb, uint16_t addr, uint8_t value);
+
+// RAM sampling: at every vblank the values of nr_addrs addresses (width 1, 2 or 4 bytes,
+// little endian) are gathered into a ring of nr_slots samples, with the frame nr and a mask of
+// values that changed since the sample before (bit n % 8 of byte n / 8). nr_addrs 0: off.
+// Returns false on bad arguments, e.g. a value past FFFF (samples unchanged). Samples are kept
+// over limeguy_load_state
+bool limeguy_set_ram_samples(struct gameboy* gb, const uint16_t* addrs, const uint8_t* widths, int nr_addrs,
+                             int nr_slots);
+int limeguy_get_ram_sample_size(struct gameboy* gb);  // bytes per sample (0: off)
+unsigned int limeguy_get_ram_sample_count(struct gameboy* gb); // samples taken so far
+// copy sample nr (0 .. count - 1), NULL pointers are skipped. False: not taken yet, or overwritten
+bool limeguy_get_ram_sample(struct gameboy* gb, unsigned int nr, void* data, uint8_t* changed,
+                            unsigned int* frame);
+
+// save states. buf holds limeguy_state_size() bytes. A state is a fixed size block without
+// pointers (can be written to disk, sent elsewhere), saving and loading are plain copies that
+// take a few microseconds. Instances that ran the same input since creation (or since loading
+// the same state) save the same bytes. Load fails for a state of another format version or ROM,
+// or with a ROM bank the ROM does not have
+size_t limeguy_state_size(void);
+bool limeguy_save_state(struct gameboy* gb, void* buf, size_t size);
+bool limeguy_load_state(struct gameboy* gb, const void* buf, size_t size);
+
+#endif
@@ -0,0 +1,204 @@
+#include <stdlib.h>
+#include <string.h>
+#include "limeguy_obs.h"
+#include "common.h"
+
+// GCC vector extensions: SSE2 / NEON / ... or plain code, whatever the target has
+typedef u8  v16u8 __attribute__((vector_size(16)));
+typedef u16 v8u16 __attribute__((vector_size(16)));
+typedef u8  v8u8  __attribute__((vector_size(8)));
+
+#define SCREEN_WIDTH  LIMEGUY_SCREEN_WIDTH
+#define SCREEN_HEIGHT LIMEGUY_SCREEN_HEIGHT
+#define SCREEN_SIZE   (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+const u8 limeguy_obs_default_gray[5] = {255, 170, 85, 0, 255};
+
+struct limeguy_obs_resizer {
+	int  width;
+	int  height;
+	int* src_x;  // first source pixel of cell, per column
+	int* nr_x;   // nr of source pixels
+	int* src_y;  // same per row
+	int* nr_y;
+	u32* area;   // pixels in cell, per output pixel
+};
+
+struct limeguy_obs_stack {
+	int nr_frames;
+	int frame_size;
+	int oldest;  // frame replaced by next push
+	u8* frames;
+};
+
+struct obs_lut {
+	v16u8 gray[5]; // gray level of color in every lane
+};
+
+static
+void obs_lut_init(struct obs_lut* lut, const u8 gray[5]) {
+	for (int col = 0; col < 5; ++col)
+		lut->gray[col] = (v16u8){0} + gray[col];
+}
+
+static inline
+v16u8 obs_lut16(v16u8 colors, const struct obs_lut* lut) {
+	// lookup as select: 5 compares instead of 16 loads
+	return ((v16u8)(colors == 0) & lut->gray[0]) |
+	       ((v16u8)(colors == 1) & lut->gray[1]) |
+	       ((v16u8)(colors == 2) & lut->gray[2]) |
+	       ((v16u8)(colors == 3) & lut->gray[3]) |
+	       ((v16u8)(colors == 4) & lut->gray[4]);
+}
+
+static inline
+v16u8 obs_load16(const u8* src) {
+	v16u8 v;
+	memcpy(&v, src, sizeof(v));
+	return v;
+}
+
+void limeguy_obs_gray(const u8* screens, int nr_screens, u8* out, const u8 gray[5]) {
+	struct obs_lut lut;
+	obs_lut_init(&lut, gray);
+	size_t size = (size_t)nr_screens * SCREEN_SIZE; // multiple of 16
+	for (size_t ii = 0; ii < size; ii += 16) {
+		v16u8 g = obs_lut16(obs_load16(&screens[ii]), &lut);
+		memcpy(&out[ii], &g, sizeof(g));
+	}
+}
+
+void limeguy_obs_pool2(const u8* screens, int nr_screens, u8* out, const u8 gray[5]) {
+	struct obs_lut lut;
+	obs_lut_init(&lut, gray);
+	for (int ss = 0; ss < nr_screens; ++ss) {
+		const u8* screen = &screens[(size_t)ss * SCREEN_SIZE];
+		u8* dest = &out[(size_t)ss * SCREEN_SIZE / 4];
+		for (int y = 0; y < SCREEN_HEIGHT / 2; ++y) {
+			const u8* line0 = &screen[2 * y * SCREEN_WIDTH];
+			const u8* line1 = line0 + SCREEN_WIDTH;
+			for (int x = 0; x < SCREEN_WIDTH; x += 16) {
+				// pixel pairs as 16 bit lanes: low byte + high byte is the pair sum
+				v8u16 top = (v8u16)obs_lut16(obs_load16(&line0[x]), &lut);
+				v8u16 bottom = (v8u16)obs_lut16(obs_load16(&line1[x]), &lut);
+				v8u16 sum = (top & 0xFF) + (top >> 8) + (bottom & 0xFF) + (bottom >> 8);
+				v8u8 mean = __builtin_convertvector((sum + 2) >> 2, v8u8);
+				memcpy(&dest[y * SCREEN_WIDTH / 2 + x / 2], &mean, sizeof(mean));
+			}
+		}
+	}
+}
+
+static
+void obs_cells(int src_size, int size, enum limeguy_obs_filter filter, int* src, int* nr) {
+	for (int ii = 0; ii < size; ++ii) {
+		if (filter == LIMEGUY_OBS_NEAREST) {
+			src[ii] = (2 * ii + 1) * src_size / (2 * size);
+			nr[ii] = 1;
+		}
+		else {
+			int end = (ii + 1) * src_size / size;
+			src[ii] = ii * src_size / size;
+			nr[ii] = end > src[ii] ? end - src[ii] : 1; // upscaling: one pixel
+		}
+	}
+}
+
+struct limeguy_obs_resizer* limeguy_obs_resizer_create(int width, int height, enum limeguy_obs_filter filter) {
+	if (width < 1 || height < 1)
+		return NULL;
+	struct limeguy_obs_resizer* rs = malloc(sizeof(struct limeguy_obs_resizer));
+	rs->width = width;
+	rs->height = height;
+	rs->src_x = malloc(width * sizeof(int));
+	rs->nr_x = malloc(width * sizeof(int));
+	rs->src_y = malloc(height * sizeof(int));
+	rs->nr_y = malloc(height * sizeof(int));
+	rs->area = malloc((size_t)width * height * sizeof(u32));
+	obs_cells(SCREEN_WIDTH, width, filter, rs->src_x, rs->nr_x);
+	obs_cells(SCREEN_HEIGHT, height, filter, rs->src_y, rs->nr_y);
+	for (int y = 0; y < height; ++y)
+		for (int x = 0; x < width; ++x)
+			rs->area[y * width + x] = rs->nr_x[x] * rs->nr_y[y];
+	return rs;
+}
+
+void limeguy_obs_resizer_destroy(struct limeguy_obs_resizer* rs) {
+	if (!rs)
+		return;
+	free(rs->src_x);
+	free(rs->nr_x);
+	free(rs->src_y);
+	free(rs->nr_y);
+	free(rs->area);
+	free(rs);
+}
+
+void limeguy_obs_resize(struct limeguy_obs_resizer* rs, const u8* screens, int nr_screens, u8* out,
+                        const u8 gray[5]) {
+	struct obs_lut lut;
+	obs_lut_init(&lut, gray);
+	int width = rs->width;
+	u8 line[SCREEN_WIDTH];
+	u32 columns[SCREEN_WIDTH]; // sum over source rows of cell
+	for (int ss = 0; ss < nr_screens; ++ss) {
+		const u8* screen = &screens[(size_t)ss * SCREEN_SIZE];
+		u8* dest = &out[(size_t)ss * width * rs->height];
+		for (int y = 0; y < rs->height; ++y) {
+			// rows first, then each cell is a short run of columns
+			memset(columns, 0, sizeof(columns));
+			for (int sy = rs->src_y[y]; sy < rs->src_y[y] + rs->nr_y[y]; ++sy) {
+				for (int x = 0; x < SCREEN_WIDTH; x += 16) {
+					v16u8 g = obs_lut16(obs_load16(&screen[sy * SCREEN_WIDTH + x]), &lut);
+					memcpy(&line[x], &g, sizeof(g));
+				}
+				for (int x = 0; x < SCREEN_WIDTH; ++x)
+					columns[x] += line[x];
+			}
+			const u32* area = &rs->area[y * width];
+			for (int x = 0; x < width; ++x) {
+				u32 sum = 0;
+				for (int sx = rs->src_x[x]; sx < rs->src_x[x] + rs->nr_x[x]; ++sx)
+					sum += columns[sx];
+				dest[y * width + x] = (sum + area[x] / 2) / area[x]; // rounded mean
+			}
+		}
+	}
+}
+
+struct limeguy_obs_stack* limeguy_obs_stack_create(int nr_frames, int frame_size) {
+	if (nr_frames < 1 || frame_size < 1)
+		return NULL;
+	struct limeguy_obs_stack* stack = malloc(sizeof(struct limeguy_obs_stack));
+	stack->nr_frames = nr_frames;
+	stack->frame_size = frame_size;
+	stack->oldest = 0;
+	stack->frames = calloc(nr_frames, frame_size);
+	return stack;
+}
+
+void limeguy_obs_stack_destroy(struct limeguy_obs_stack* stack) {
+	if (!stack)
+		return;
+	free(stack->frames);
+	free(stack);
+}
+
+u8* limeguy_obs_stack_push(struct limeguy_obs_stack* stack) {
+	u8* frame = &stack->frames[(size_t)stack->oldest * stack->frame_size];
+	stack->oldest = (stack->oldest + 1) % stack->nr_frames;
+	return frame;
+}
+
+void limeguy_obs_stack_fill(struct limeguy_obs_stack* stack, const u8* frame) {
+	for (int ii = 0; ii < stack->nr_frames; ++ii)
+		memcpy(&stack->frames[(size_t)ii * stack->frame_size], frame, stack->frame_size);
+	stack->oldest = 0;
+}
+
+void limeguy_obs_stack_get(struct limeguy_obs_stack* stack, u8* out) {
+	// ring from oldest to end, then start to newest
+	size_t first = (size_t)(stack->nr_frames - stack->oldest) * stack->frame_size;
+	memcpy(out, &stack->frames[(size_t)stack->oldest * stack->frame_size], first);
+	memcpy(&out[first], stack->frames, (size_t)stack->oldest * stack->frame_size);
+}
@@ -0,0 +1,44 @@
+#ifndef __LIMEGUY_OBS_H__
+#define __LIMEGUY_OBS_H__
+
+// Observation preprocessing for screens as written by limeguy_copy_screen() / limeguy_vec_step()
+// (160 x 144, one color 0 .. 3 per byte, 4: LCD off). All kernels take nr_screens screens
+// back to back and write gray images back to back into caller memory
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "limeguy.h"
+
+// gray level for each color (and LCD off)
+extern const uint8_t limeguy_obs_default_gray[5];
+
+// 160 x 144 gray
+void limeguy_obs_gray(const uint8_t* screens, int nr_screens, uint8_t* out, const uint8_t gray[5]);
+// 80 x 72 gray, mean of 2 x 2 pixels (same as the area resize, but faster)
+void limeguy_obs_pool2(const uint8_t* screens, int nr_screens, uint8_t* out, const uint8_t gray[5]);
+
+// any output size. Nearest: center pixel. Area: mean of the source pixels in the cell
+enum limeguy_obs_filter {
+	LIMEGUY_OBS_NEAREST,
+	LIMEGUY_OBS_AREA
+};
+struct limeguy_obs_resizer;
+struct limeguy_obs_resizer* limeguy_obs_resizer_create(int width, int height, enum limeguy_obs_filter filter);
+void limeguy_obs_resizer_destroy(struct limeguy_obs_resizer* rs);
+// out: width x height gray per screen
+void limeguy_obs_resize(struct limeguy_obs_resizer* rs, const uint8_t* screens, int nr_screens, uint8_t* out,
+                        const uint8_t gray[5]);
+
+// frame stack: ring of the last nr_frames frames of frame_size bytes (e.g. one observation,
+// or the observations of all instances of a limeguy_vec)
+struct limeguy_obs_stack;
+struct limeguy_obs_stack* limeguy_obs_stack_create(int nr_frames, int frame_size);
+void limeguy_obs_stack_destroy(struct limeguy_obs_stack* stack);
+// where to write the next frame (kernels can write there directly), it replaces the oldest one
+uint8_t* limeguy_obs_stack_push(struct limeguy_obs_stack* stack);
+// all frames become frame (e.g. at episode start)
+void limeguy_obs_stack_fill(struct limeguy_obs_stack* stack, const uint8_t* frame);
+// copy frames oldest to newest into out (nr_frames * frame_size bytes)
+void limeguy_obs_stack_get(struct limeguy_obs_stack* stack, uint8_t* out);
+
+#endif
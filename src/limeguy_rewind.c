@@ -0,0 +1,261 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "limeguy_rewind.h"
+#include "common.h"
+
+#define RUN_DATA 0x8000
+#define RUN_MAX  0x7FF8 // bytes, whole words
+
+struct rewind_frame {
+	size_t offset; // in buffer
+	size_t size;
+	bool   key;
+};
+
+struct limeguy_rewind {
+	u8*                  buffer;
+	size_t               buffer_size;
+	size_t               head; // end of newest frame
+
+	struct rewind_frame* frames; // ring, oldest is always a keyframe
+	int                  max_frames;
+	int                  first;
+	int                  nr_frames;
+
+	int                  keyframe_interval;
+	int                  since_key;  // frames after newest keyframe
+	size_t               state_size; // multiple of 8 (cache aligned parts)
+	u8*                  key_state;  // state of newest keyframe
+	u8*                  state;      // scratch
+	u8*                  encoded;    // scratch, worst case size
+};
+
+static
+struct rewind_frame* rewind_frame(struct limeguy_rewind* rw, int nr) {
+	// nr 0: oldest
+	return &rw->frames[(rw->first + nr) % rw->max_frames];
+}
+
+static
+size_t rewind_max_encoded(size_t state_size) {
+	// runs are at least one word: one header per 4 words at worst
+	return state_size + state_size / 4 + 2;
+}
+
+struct limeguy_rewind* limeguy_rewind_create(size_t buffer_size, int max_frames, int keyframe_interval) {
+	if (!buffer_size || max_frames < 2 || keyframe_interval < 1)
+		return NULL;
+	struct limeguy_rewind* rw = malloc(sizeof(struct limeguy_rewind));
+	rw->buffer = malloc(buffer_size);
+	rw->buffer_size = buffer_size;
+	rw->frames = malloc(max_frames * sizeof(struct rewind_frame));
+	rw->max_frames = max_frames;
+	rw->keyframe_interval = keyframe_interval;
+	rw->state_size = limeguy_state_size();
+	rw->key_state = malloc(rw->state_size);
+	rw->state = malloc(rw->state_size);
+	rw->encoded = malloc(rewind_max_encoded(rw->state_size));
+	limeguy_rewind_clear(rw);
+	return rw;
+}
+
+void limeguy_rewind_destroy(struct limeguy_rewind* rw) {
+	if (!rw)
+		return;
+	free(rw->buffer);
+	free(rw->frames);
+	free(rw->key_state);
+	free(rw->state);
+	free(rw->encoded);
+	free(rw);
+}
+
+void limeguy_rewind_clear(struct limeguy_rewind* rw) {
+	rw->head = 0;
+	rw->first = 0;
+	rw->nr_frames = 0;
+	rw->since_key = 0;
+}
+
+int limeguy_rewind_get_nr_frames(struct limeguy_rewind* rw) {
+	return rw->nr_frames;
+}
+
+size_t limeguy_rewind_get_used(struct limeguy_rewind* rw) {
+	size_t used = 0;
+	for (int ii = 0; ii < rw->nr_frames; ++ii)
+		used += rewind_frame(rw, ii)->size;
+	return used;
+}
+
+static
+void rewind_put_run(u8* out, size_t* pos, size_t len, bool data) {
+	u16 header = len | (data ? RUN_DATA : 0);
+	memcpy(&out[*pos], &header, sizeof(header));
+	*pos += sizeof(header);
+}
+
+static
+size_t rewind_encode(const u8* state, const u8* key, size_t size, u8* out) {
+	// XOR with key (NULL: zeros) a word at a time, runs of equal words are skipped
+	size_t pos = 0;
+	size_t ii = 0;
+	while (ii < size) {
+		size_t start = ii;
+		uint64_t word;
+		for (; ii < size && ii - start < RUN_MAX; ii += 8) {
+			memcpy(&word, &state[ii], 8);
+			if (key) {
+				uint64_t key_word;
+				memcpy(&key_word, &key[ii], 8);
+				word ^= key_word;
+			}
+			if (word)
+				break;
+		}
+		if (ii > start) {
+			rewind_put_run(out, &pos, ii - start, false);
+			continue;
+		}
+		size_t header = pos;
+		pos += sizeof(u16);
+		for (; ii < size && ii - start < RUN_MAX; ii += 8) {
+			memcpy(&word, &state[ii], 8);
+			if (key) {
+				uint64_t key_word;
+				memcpy(&key_word, &key[ii], 8);
+				word ^= key_word;
+			}
+			if (!word)
+				break;
+			memcpy(&out[pos], &word, 8);
+			pos += 8;
+		}
+		rewind_put_run(out, &header, ii - start, true);
+	}
+	return pos;
+}
+
+static
+void rewind_decode(const u8* in, size_t in_size, u8* state) {
+	// state holds keyframe (or zeros): XOR data runs into it
+	size_t pos = 0;
+	size_t ii = 0;
+	while (pos < in_size) {
+		u16 header;
+		memcpy(&header, &in[pos], sizeof(header));
+		pos += sizeof(header);
+		size_t len = header & ~RUN_DATA;
+		if (header & RUN_DATA) {
+			for (size_t jj = 0; jj < len; jj += 8) {
+				uint64_t word, delta;
+				memcpy(&word, &state[ii + jj], 8);
+				memcpy(&delta, &in[pos + jj], 8);
+				word ^= delta;
+				memcpy(&state[ii + jj], &word, 8);
+			}
+			pos += len;
+		}
+		ii += len;
+	}
+}
+
+static
+void rewind_drop_oldest(struct limeguy_rewind* rw) {
+	// keyframe and its deltas
+	do {
+		rw->first = (rw->first + 1) % rw->max_frames;
+		--rw->nr_frames;
+	} while (rw->nr_frames && !rewind_frame(rw, 0)->key);
+	if (!rw->nr_frames)
+		rw->head = 0;
+}
+
+static
+bool rewind_make_room(struct limeguy_rewind* rw, size_t size, size_t* offset) {
+	// frames are contiguous, the newest right after the one before or at buffer start
+	if (size > rw->buffer_size)
+		return false;
+	for (;;) {
+		if (rw->nr_frames == rw->max_frames) {
+			rewind_drop_oldest(rw);
+			continue;
+		}
+		if (!rw->nr_frames) {
+			*offset = 0;
+			return true;
+		}
+		size_t tail = rewind_frame(rw, 0)->offset;
+		if (rw->head > tail) { // in use: tail .. head
+			if (rw->buffer_size - rw->head >= size) {
+				*offset = rw->head;
+				return true;
+			}
+			if (tail >= size) {
+				*offset = 0;
+				return true;
+			}
+		}
+		else if (tail - rw->head >= size) { // in use: tail .. end, start .. head
+			*offset = rw->head;
+			return true;
+		}
+		rewind_drop_oldest(rw);
+	}
+}
+
+bool limeguy_rewind_push(struct limeguy_rewind* rw, struct gameboy* gb) {
+	limeguy_save_state(gb, rw->state, rw->state_size);
+	bool key = !rw->nr_frames || rw->since_key + 1 >= rw->keyframe_interval;
+	size_t size = rewind_encode(rw->state, key ? NULL : rw->key_state, rw->state_size, rw->encoded);
+	size_t offset;
+	if (!rewind_make_room(rw, size, &offset))
+		return false;
+	if (!key && !rw->nr_frames) {
+		// own keyframe was dropped for room
+		key = true;
+		size = rewind_encode(rw->state, NULL, rw->state_size, rw->encoded);
+		if (!rewind_make_room(rw, size, &offset))
+			return false;
+	}
+
+	memcpy(&rw->buffer[offset], rw->encoded, size);
+	struct rewind_frame* frame = rewind_frame(rw, rw->nr_frames++);
+	frame->offset = offset;
+	frame->size = size;
+	frame->key = key;
+	rw->head = offset + size;
+	if (key) {
+		memcpy(rw->key_state, rw->state, rw->state_size);
+		rw->since_key = 0;
+	}
+	else
+		++rw->since_key;
+	return true;
+}
+
+bool limeguy_rewind_step_back(struct limeguy_rewind* rw, struct gameboy* gb) {
+	if (rw->nr_frames < 2)
+		return false;
+	struct rewind_frame* newest = rewind_frame(rw, --rw->nr_frames);
+	struct rewind_frame* frame = rewind_frame(rw, rw->nr_frames - 1);
+	if (newest->key) {
+		// back into frames of the keyframe before
+		int key_nr = rw->nr_frames - 1;
+		while (!rewind_frame(rw, key_nr)->key)
+			--key_nr;
+		struct rewind_frame* key = rewind_frame(rw, key_nr);
+		memset(rw->key_state, 0, rw->state_size);
+		rewind_decode(&rw->buffer[key->offset], key->size, rw->key_state);
+		rw->since_key = rw->nr_frames - 1 - key_nr;
+	}
+	else
+		--rw->since_key;
+
+	memcpy(rw->state, rw->key_state, rw->state_size);
+	if (!frame->key)
+		rewind_decode(&rw->buffer[frame->offset], frame->size, rw->state);
+	rw->head = frame->offset + frame->size;
+	return limeguy_load_state(gb, rw->state, rw->state_size);
+}
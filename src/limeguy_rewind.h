@@ -0,0 +1,34 @@
+#ifndef __LIMEGUY_REWIND_H__
+#define __LIMEGUY_REWIND_H__
+
+// Rewind: ring of recent save states (see limeguy_save_state) in a fixed size buffer. Every
+// keyframe_interval frames a keyframe is stored, the frames in between only as difference to
+// their keyframe (XOR, zero runs left out). Going back one frame decodes one keyframe (when it
+// isn't the current one) and one delta. Oldest frames are dropped when the buffer is full
+//
+// Encoded state: runs of u16 header (bit 15: data follows, bits 0 .. 14: length in bytes),
+// followed by length bytes to XOR into the keyframe (or into zeros for a keyframe) if bit 15 is
+// set. Without it the run is the same as in the keyframe
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "limeguy.h"
+
+struct limeguy_rewind;
+
+// buffer_size: bytes for encoded states, max_frames: most frames kept. NULL on bad arguments
+struct limeguy_rewind* limeguy_rewind_create(size_t buffer_size, int max_frames, int keyframe_interval);
+void limeguy_rewind_destroy(struct limeguy_rewind* rw);
+
+// store current state (call after each frame). False: doesn't fit in buffer at all
+bool limeguy_rewind_push(struct limeguy_rewind* rw, struct gameboy* gb);
+// back one frame: forget newest frame and load the one before, which stays stored.
+// False: no older frame (gb unchanged)
+bool limeguy_rewind_step_back(struct limeguy_rewind* rw, struct gameboy* gb);
+// forget all frames (e.g. after loading another state)
+void limeguy_rewind_clear(struct limeguy_rewind* rw);
+
+int limeguy_rewind_get_nr_frames(struct limeguy_rewind* rw);
+size_t limeguy_rewind_get_used(struct limeguy_rewind* rw); // bytes of buffer holding frames
+
+#endif
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE // aligned_alloc
+#include <stdlib.h>
+#include <string.h>
+#include "limeguy_vec.h"
+#include "threadpool.h"
+#include "common.h"
+#include "mem.h"
+
+struct limeguy_vec_env {
+	struct gameboy* gb;
+	unsigned int    episode_frames; // frames since last reset
+} __attribute__((aligned(64))); // updated by different workers
+
+struct limeguy_vec {
+	int                     nr_envs;
+	struct limeguy_vec_env* envs;
+	struct threadpool*      pool;
+	struct instpool*        arenas; // of the instances
+
+	const void*             rom_data; // while creating
+	size_t                  rom_size;
+
+	int                     sample_size;  // RAM sample
+	int                     changed_size; // its changed mask
+
+	u8*                     start_state;
+	size_t                  state_size;
+	unsigned int            max_frames;
+
+	// current step
+	const u8*               buttons;
+	unsigned int            nr_frames;
+	u8*                     screens;
+	bool*                   done;
+};
+
+static
+void limeguy_vec_create_env(void* ctx, int task, int worker) {
+	// on the worker that will mostly run it (workers are pinned): arena on the NUMA node of
+	// that worker
+	(void)worker;
+	struct limeguy_vec* vec = ctx;
+	vec->envs[task].gb = limeguy_create_in_pool(vec->arenas, vec->rom_data, vec->rom_size);
+	vec->envs[task].episode_frames = 0;
+}
+
+struct limeguy_vec* limeguy_vec_create(const void* rom_data, size_t rom_size, int nr_envs, int nr_threads) {
+	if (nr_envs < 1)
+		return NULL;
+	struct limeguy_vec* vec = malloc(sizeof(struct limeguy_vec));
+	memset(vec, 0, sizeof(struct limeguy_vec));
+	vec->nr_envs = nr_envs;
+	vec->envs = aligned_alloc(64, nr_envs * sizeof(struct limeguy_vec_env));
+	vec->pool = threadpool_create(nr_threads, true);
+	vec->arenas = limeguy_pool_create(rom_size);
+	if (!vec->envs || !vec->pool || !vec->arenas) {
+		vec->nr_envs = 0; // no instances to destroy
+		limeguy_vec_destroy(vec);
+		return NULL;
+	}
+	vec->rom_data = rom_data;
+	vec->rom_size = rom_size;
+	threadpool_run(vec->pool, limeguy_vec_create_env, vec, nr_envs);
+	vec->rom_data = NULL;
+	for (int ii = 0; ii < nr_envs; ++ii) {
+		if (!vec->envs[ii].gb) {
+			limeguy_vec_destroy(vec);
+			return NULL;
+		}
+	}
+
+	vec->state_size = limeguy_state_size();
+	vec->start_state = malloc(vec->state_size);
+	limeguy_save_state(vec->envs[0].gb, vec->start_state, vec->state_size);
+	return vec;
+}
+
+void limeguy_vec_destroy(struct limeguy_vec* vec) {
+	if (!vec)
+		return;
+	threadpool_destroy(vec->pool);
+	for (int ii = 0; ii < vec->nr_envs; ++ii)
+		limeguy_destroy(vec->envs[ii].gb);
+	limeguy_pool_destroy(vec->arenas);
+	free(vec->envs);
+	free(vec->start_state);
+	free(vec);
+}
+
+int limeguy_vec_get_nr_envs(struct limeguy_vec* vec) {
+	return vec->nr_envs;
+}
+
+struct gameboy* limeguy_vec_get(struct limeguy_vec* vec, int env) {
+	return env >= 0 && env < vec->nr_envs ? vec->envs[env].gb : NULL;
+}
+
+bool limeguy_vec_set_start_state(struct limeguy_vec* vec, const void* state, size_t size) {
+	if (size != vec->state_size)
+		return false;
+	memcpy(vec->start_state, state, size);
+	return true;
+}
+
+void limeguy_vec_set_max_frames(struct limeguy_vec* vec, unsigned int max_frames) {
+	vec->max_frames = max_frames;
+}
+
+bool limeguy_vec_set_ram_samples(struct limeguy_vec* vec, const u16* addrs, const u8* widths, int nr_addrs,
+                                 int nr_slots) {
+	// all or none: only the check can fail
+	if (!mem_check_samples(addrs, widths, nr_addrs, nr_slots))
+		return false;
+	for (int ii = 0; ii < vec->nr_envs; ++ii)
+		limeguy_set_ram_samples(vec->envs[ii].gb, addrs, widths, nr_addrs, nr_slots);
+	vec->sample_size = limeguy_get_ram_sample_size(vec->envs[0].gb);
+	vec->changed_size = nr_addrs > 0 ? (nr_addrs + 7) / 8 : 0;
+	return true;
+}
+
+void limeguy_vec_get_ram(struct limeguy_vec* vec, u8* out, u8* changed) {
+	for (int ii = 0; ii < vec->nr_envs; ++ii) {
+		struct gameboy* gb = vec->envs[ii].gb;
+		u8* data = &out[(size_t)ii * vec->sample_size];
+		u8* mask = changed ? &changed[(size_t)ii * vec->changed_size] : NULL;
+		unsigned int count = limeguy_get_ram_sample_count(gb);
+		if (!count || !limeguy_get_ram_sample(gb, count - 1, data, mask, NULL)) {
+			memset(data, 0, vec->sample_size);
+			if (mask)
+				memset(mask, 0, vec->changed_size);
+		}
+	}
+}
+
+static
+void limeguy_vec_reset_env(struct limeguy_vec* vec, struct limeguy_vec_env* env) {
+	limeguy_load_state(env->gb, vec->start_state, vec->state_size);
+	env->episode_frames = 0;
+}
+
+void limeguy_vec_reset(struct limeguy_vec* vec, int env) {
+	for (int ii = 0; ii < vec->nr_envs; ++ii)
+		if (env < 0 || env == ii)
+			limeguy_vec_reset_env(vec, &vec->envs[ii]);
+}
+
+static
+void limeguy_vec_step_env(void* ctx, int task, int worker) {
+	(void)worker;
+	struct limeguy_vec* vec = ctx;
+	struct limeguy_vec_env* env = &vec->envs[task];
+	struct gameboy* gb = env->gb;
+
+	limeguy_set_buttons(gb, vec->buttons[task]);
+	bool done = false;
+	for (unsigned int ii = 0; ii < vec->nr_frames && !done; ++ii) {
+		done = limeguy_run_until(gb, LIMEGUY_EVENT_VBLANK, 0) == LIMEGUY_EVENT_STOP;
+		++env->episode_frames;
+		done = done || (vec->max_frames && env->episode_frames >= vec->max_frames);
+	}
+	limeguy_copy_screen(gb, &vec->screens[(size_t)task * LIMEGUY_VEC_SCREEN_SIZE]);
+	if (vec->done)
+		vec->done[task] = done;
+	if (done)
+		limeguy_vec_reset_env(vec, env);
+}
+
+void limeguy_vec_step(struct limeguy_vec* vec, const u8* buttons, unsigned int nr_frames, u8* screens, bool* done) {
+	vec->buttons = buttons;
+	vec->nr_frames = nr_frames;
+	vec->screens = screens;
+	vec->done = done;
+	threadpool_run(vec->pool, limeguy_vec_step_env, vec, vec->nr_envs);
+}
@@ -0,0 +1,51 @@
+#ifndef __LIMEGUY_VEC_H__
+#define __LIMEGUY_VEC_H__
+
+// Vectorized environment: N instances of one ROM, stepped together on a thread pool.
+// Every step takes one button mask per instance, runs all of them a fixed number of
+// frames and writes all screens into one caller buffer. An instance that is done
+// (CPU stopped, or episode frame limit reached) is reset to the start state
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "limeguy.h"
+
+#define LIMEGUY_VEC_SCREEN_SIZE (LIMEGUY_SCREEN_WIDTH * LIMEGUY_SCREEN_HEIGHT)
+
+struct limeguy_vec;
+
+// nr_threads <= 0: one per core. Workers are pinned to cores. Start state is the power-on state.
+// Instances are created on the workers, in an instance pool (see limeguy_pool_create). Returns
+// NULL on error
+struct limeguy_vec* limeguy_vec_create(const void* rom_data, size_t rom_size, int nr_envs, int nr_threads);
+void limeguy_vec_destroy(struct limeguy_vec* vec);
+
+int limeguy_vec_get_nr_envs(struct limeguy_vec* vec);
+// instance, e.g. to read RAM for rewards. Not while stepping
+struct gameboy* limeguy_vec_get(struct limeguy_vec* vec, int env);
+
+// start state for resets (copied, see limeguy_save_state). Does not reset the instances
+bool limeguy_vec_set_start_state(struct limeguy_vec* vec, const void* state, size_t size);
+// episode ends after this many frames (0: only when CPU stops)
+void limeguy_vec_set_max_frames(struct limeguy_vec* vec, unsigned int max_frames);
+// env < 0: all instances
+void limeguy_vec_reset(struct limeguy_vec* vec, int env);
+
+// RAM sampling on all instances, see limeguy_set_ram_samples(). nr_slots per instance. On false no
+// instance is changed
+bool limeguy_vec_set_ram_samples(struct limeguy_vec* vec, const uint16_t* addrs, const uint8_t* widths,
+                                 int nr_addrs, int nr_slots);
+// latest sample of every instance into out (nr_envs * limeguy_get_ram_sample_size() bytes) and
+// changed (nr_envs masks of (nr_addrs + 7) / 8 bytes, may be NULL). Instance without sample: zeros
+void limeguy_vec_get_ram(struct limeguy_vec* vec, uint8_t* out, uint8_t* changed);
+
+// buttons[env]: pressed buttons, as limeguy_set_buttons(). Each instance runs nr_frames
+// frames (less when done). screens: nr_envs screens of LIMEGUY_VEC_SCREEN_SIZE bytes,
+// colors as limeguy_copy_screen(). done[env] (may be NULL): episode ended in this step.
+// Screen is the last one of the episode, the instance already starts from the start
+// state in the next step
+void limeguy_vec_step(struct limeguy_vec* vec, const uint8_t* buttons, unsigned int nr_frames, uint8_t* screens,
+                      bool* done);
+
+#endif
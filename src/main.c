@@ -3,12 +3,16 @@
 #include <bits/time.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include <raylib.h>
 
-#include "gameboy.h"
+#include "limeguy.h"
+#include "limeguy_rewind.h"
+#include "gameboy.h" // debug output and options below use internals
 #include "cpu.h"
 #include "ppu.h"
 #include "common.h"
@@ -25,23 +29,26 @@ const int winHeight = pixScale * imgHeight;
 
 const unsigned int fps = 60;
 const unsigned int mcycles_per_second = 1024 * 1024; // M-cycle speed: 2^22 / 4
-const unsigned int mcycles_per_frame = mcycles_per_second / fps;
+
+// rewind (hold R): up to a minute back, keyframe every second
+const size_t rewind_buffer_size = 32 * 1024 * 1024;
+const int rewind_seconds = 60;
 
 // Keyboard mapping RayLib --> Gameboy button
 struct keymap {
-	int            key;
-	enum gb_button button;
+	int                 key;
+	enum limeguy_button button;
 };
 
 struct keymap keymaps[8] = {
-	{ KEY_RIGHT, BUT_RIGHT },
-	{ KEY_LEFT, BUT_LEFT },
-	{ KEY_UP, BUT_UP },
-	{ KEY_DOWN, BUT_DOWN },
-	{ KEY_X, BUT_A },
-	{ KEY_Z, BUT_B },
-	{ KEY_S, BUT_SELECT },
-	{ KEY_ENTER, BUT_START }
+	{ KEY_RIGHT, LIMEGUY_BUTTON_RIGHT },
+	{ KEY_LEFT, LIMEGUY_BUTTON_LEFT },
+	{ KEY_UP, LIMEGUY_BUTTON_UP },
+	{ KEY_DOWN, LIMEGUY_BUTTON_DOWN },
+	{ KEY_X, LIMEGUY_BUTTON_A },
+	{ KEY_Z, LIMEGUY_BUTTON_B },
+	{ KEY_S, LIMEGUY_BUTTON_SELECT },
+	{ KEY_ENTER, LIMEGUY_BUTTON_START }
 };
 
 // palette
@@ -71,9 +78,59 @@ unsigned int max_instr = 0;
 unsigned int max_mcycles = 0;
 unsigned int start_logging_instrnr = 0;
 bool have_graphics = true; // if false, does not even open window
+int frame_skip = 0;
+bool render_thread = false; // draw scanlines on separate thread
+bool fifo_renderer = false; // dot accurate PPU
+
+// debugger state, used by emulation thread
+FILE* logfile = NULL;
+bool break_hit = false;
+
+// input events: main (raylib) thread --> emulation thread, lock-free single producer / single consumer
+enum input_event_type {
+	INPUT_BUTTON,
+	INPUT_DEBUG_BREAK,
+	INPUT_REWIND
+};
+
+struct input_event {
+	u8   type;   // enum input_event_type
+	u8   button; // enum limeguy_button
+	bool pressed; // also rewind key
+};
+
+#define INPUT_QUEUE_SIZE 64 /* power of 2 */
+struct input_queue {
+	struct input_event events[INPUT_QUEUE_SIZE];
+	unsigned int       head; // next to write, only written by main thread
+	unsigned int       tail; // next to read, only written by emulation thread
+};
+
+// frames: emulation thread --> main thread, triple buffered. Neither side ever waits:
+// emulation draws into back, main shows front, finished frames are swapped through shared
+#define FRAME_FRESH 4 /* flag in shared: frame not yet taken by main thread */
+struct frame_buffers {
+	u8* pixels[3];
+	u32 stale[3][LIMEGUY_LINE_WORDS]; // lines changed since buffer was drawn into, emulation thread only
+	int back;   // emulation thread only
+	int shared; // buffer index | FRAME_FRESH, exchanged atomically
+	int front;  // main thread only
+};
+
+struct emu_thread {
+	pthread_t            thread;
+	struct gameboy*      gameboy;
+	struct input_queue   input;
+	struct frame_buffers frames;
+	struct limeguy_rewind* rewind;
+	bool                 rewinding; // emulation thread only, as buttons
+	u8                   buttons;   // pressed buttons, restored after going back
+	bool                 quit;     // set by main thread
+	bool                 finished; // set by emulation thread: program should end
+};
 
 void print_usage(char* progname) {
-	printf("Usage: %s [[b]addr_hex] [[i]instr#] [lLogfile] [sinstr#] [m????] [M????] [n] <romfile>\n", progname);
+	printf("Usage: %s [[b]addr_hex] [[i]instr#] [lLogfile] [sinstr#] [m????] [M????] [n] [f#] [t] [a] <romfile>\n", progname);
 	printf("  b option: breakpoint at address (default: $0100)\n");
 	printf("  i option: breakpoint at from instr# (default: 1)\n");
 	printf("  l option: game boy doctor output enable (status line after each instr)\n");
@@ -81,7 +138,11 @@ void print_usage(char* progname) {
 	printf("  m option: max # instructions to run\n");
 	printf("  M option: max # Mcycles to run\n");
 	printf("  n option: No graphics, no window\n");
+	printf("  f option: frame skip, draw 1 out of every # + 1 frames\n");
+	printf("  t option: draw scanlines on separate thread\n");
+	printf("  a option: accurate (dot by dot) PPU, slower\n");
 	printf("---\n");
+	printf("Keys: arrows, X (A), Z (B), S (select), Enter (start), D (debug break), hold R (rewind)\n");
 	printf("When in step-by-step mode:\n");
 	printf("  q: exit program\n");
 	printf("  c: continue (exit step-by-step mode)\n");
@@ -116,6 +177,12 @@ void parse_arguments(int argc, char* argv[]) { // uses globals for now
 			max_mcycles = atoi(argv[ii] + 1);
 		else if (argv[ii][0] == 'n')
 			have_graphics = false;
+		else if (argv[ii][0] == 'f')
+			frame_skip = atoi(argv[ii] + 1);
+		else if (argv[ii][0] == 't')
+			render_thread = true;
+		else if (argv[ii][0] == 'a')
+			fifo_renderer = true;
 	}
 }
 
@@ -127,28 +194,205 @@ Texture load_dynamic_texture(int w, int h) {
 }
 
 static
-void get_keyboard_input(struct gameboy* gameboy) {
-	for (int ii = 0; ii < (int)(sizeof(keymaps) / sizeof(keymaps[0])); ++ii)
-		gameboy_set_button(gameboy, keymaps[ii].button, IsKeyDown(keymaps[ii].key));
+bool input_queue_push(struct input_queue* q, struct input_event ev) {
+	// returns false when queue is full
+	if (q->head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == INPUT_QUEUE_SIZE)
+		return false;
+	q->events[q->head & (INPUT_QUEUE_SIZE - 1)] = ev;
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static
+bool input_queue_pop(struct input_queue* q, struct input_event* ev) {
+	if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == q->tail)
+		return false;
+	*ev = q->events[q->tail & (INPUT_QUEUE_SIZE - 1)];
+	__atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+static
+void frame_buffers_publish(struct frame_buffers* fb) {
+	// emulation thread: hand over finished back buffer, continue with whatever was shared
+	int prev = __atomic_exchange_n(&fb->shared, fb->back | FRAME_FRESH, __ATOMIC_ACQ_REL);
+	fb->back = prev & ~FRAME_FRESH;
+}
+
+static
+bool frame_buffers_take(struct frame_buffers* fb) {
+	// main thread: swap in latest frame, if there is a new one
+	if (!(__atomic_load_n(&fb->shared, __ATOMIC_ACQUIRE) & FRAME_FRESH))
+		return false;
+	int prev = __atomic_exchange_n(&fb->shared, fb->front, __ATOMIC_ACQ_REL);
+	fb->front = prev & ~FRAME_FRESH;
+	return true;
 }
 
 static
-void write_log_line(struct gameboy* gameboy, FILE* logfile) {
+void get_keyboard_input(struct input_queue* q) {
+	// send button changes to emulation thread
+	static u8 buttons_sent = 0;
+	for (int ii = 0; ii < (int)(sizeof(keymaps) / sizeof(keymaps[0])); ++ii) {
+		bool down = IsKeyDown(keymaps[ii].key);
+		u8 bit = 1 << keymaps[ii].button;
+		if (down == ((buttons_sent & bit) != 0))
+			continue;
+		struct input_event ev = {.type = INPUT_BUTTON, .button = keymaps[ii].button, .pressed = down};
+		if (input_queue_push(q, ev)) // queue full: try again next frame
+			buttons_sent ^= bit;
+	}
+	// debug key
+	if (IsKeyPressed(KEY_D))
+		input_queue_push(q, (struct input_event) {.type = INPUT_DEBUG_BREAK});
+	// rewind while key is held
+	if (IsKeyPressed(KEY_R) || IsKeyReleased(KEY_R))
+		input_queue_push(q, (struct input_event) {.type = INPUT_REWIND, .pressed = IsKeyDown(KEY_R)});
+}
+
+static
+void write_log_line(struct gameboy* gameboy, FILE* log_out) {
 #ifdef EXTRA_LOGGING
-		fprintf(logfile, "%8u ", gameboy->cpu->nr_instructions + 1);
+		fprintf(log_out, "%8u ", gameboy->cpu->nr_instructions + 1);
 		if (gameboy->ppu)
-			fprintf(logfile, "%d,%d ", gameboy->ppu->xdot, gameboy->ppu->ly);
+			fprintf(log_out, "%d,%d ", gameboy->ppu->xdot, gameboy->ppu->ly);
 		// if (gameboy->timers)
-		// 	fprintf(logfile, "%d,%d ", gameboy->timers->count_div, gameboy->mem->io[0x04]);
-		//fprintf(logfile, "%d ", gameboy->timers->count_div);
+		// 	fprintf(log_out, "%d,%d ", gameboy->timers->count_div, gameboy->mem->io[0x04]);
+		//fprintf(log_out, "%d ", gameboy->timers->count_div);
+#endif
+		cpu_print_state_gbdoctor(gameboy->cpu, log_out);
+}
+
+static
+bool run_frame(struct gameboy* gameboy) {
+	// run instructions until frame is done (or some max is exceeded). Returns true when program should end
+	bool done = false;
+	bool frame_done = false;
+	cpu_reset_mcycle_frame(gameboy->cpu);
+	while (!done && !frame_done) { // Frame loop
+		// TODO: clean-up!! Especially interactive breakpoint code
+
+		if (logfile && gameboy->cpu->nr_instructions + 1 >= start_logging_instrnr)
+			write_log_line(gameboy, logfile);
+
+		// break point conditions
+		if (break_instrnr > 0 && gameboy->cpu->nr_instructions + 1 == break_instrnr)
+			break_hit = true;
+		if (break_addr >= 0 && gameboy->cpu->PC == break_addr)
+			break_hit = true;
+		if (limeguy_read(gameboy, 0xFF03) != 0xFF) // unused IO addr used as break, when not read as 0xFF
+			break_hit = true;
+#ifdef INSTR_BREAK
+		if (cpu_get_opcode_at_pc(gameboy->cpu) == INSTR_BREAK) //break on LD B,B (mooneye test suite)
+			break_hit = true;
 #endif
-		cpu_print_state_gbdoctor(gameboy->cpu, logfile);
+		if (break_hit) {
+			printf("\nInstr #: %u\n", gameboy->cpu->nr_instructions + 1);
+			cpu_print_info(gameboy->cpu);
+			ppu_print_info(gameboy->ppu);
+			char buf[80];
+			fgets(buf, 80, stdin);
+			if (buf[0] == 'q')
+				done = true; // causes program to exit
+			else if (buf[0] == 'c')
+				break_hit = false;
+			else if (buf[0] == 'm') {
+				u16 disp_addr = strtol(buf + 1, NULL, 16);
+				printf("Mem content: $%02X\n", limeguy_read(gameboy, disp_addr));
+			}
+			else if (buf[0] == 'l' && !logfile) {
+				// Remove newline
+				char* bb = buf + 1;
+				while (*bb && *bb != '\n')
+					++bb;
+				*bb = '\0';
+				break_hit = false; // continue execution normally
+				logfile = fopen(buf + 1, "w");
+				if (!logfile)
+					fprintf(stderr, "Error: could not open log file %s\n", buf + 1);
+			}
+		}
+
+		limeguy_step(gameboy);
+
+		// exit conditions
+		if (gameboy->cpu->nr_instructions == max_instr || (max_mcycles && gameboy->cpu->nr_mcycles >= max_mcycles))
+			done = true;
+		// use ppu signaling hand-shake to see if frame is done (also when LCD is off)
+		if (gameboy->ppu && ppu_frame_is_done(gameboy->ppu)) {
+			ppu_reset_frame_done(gameboy->ppu);
+			frame_done = true;
+		}
+	} // end frame loop
+	return done;
+}
+
+static
+void emu_thread_apply_input(struct emu_thread* et) {
+	struct input_event ev;
+	while (input_queue_pop(&et->input, &ev)) {
+		if (ev.type == INPUT_BUTTON) {
+			limeguy_set_button(et->gameboy, ev.button, ev.pressed);
+			et->buttons = ev.pressed ? et->buttons | (1 << ev.button) : et->buttons & ~(1 << ev.button);
+		}
+		else if (ev.type == INPUT_DEBUG_BREAK)
+			break_hit = true;
+		else if (ev.type == INPUT_REWIND)
+			et->rewinding = ev.pressed;
+	}
+}
+
+static
+void* emu_thread_run(void* arg) {
+	// emulation at fps frames per second, independent of drawing and vsync of main thread
+	struct emu_thread* et = arg;
+	struct frame_buffers* fb = &et->frames;
+	const long frame_ns = 1000000000L / fps;
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (!__atomic_load_n(&et->quit, __ATOMIC_ACQUIRE) && !cpu_is_stopped(et->gameboy->cpu)) {
+		emu_thread_apply_input(et);
+		if (et->rewinding) {
+			// one frame back per frame, stops at oldest one kept. Loading sets old buttons
+			if (limeguy_rewind_step_back(et->rewind, et->gameboy))
+				limeguy_set_buttons(et->gameboy, et->buttons);
+		}
+		else {
+			if (run_frame(et->gameboy))
+				break;
+			limeguy_rewind_push(et->rewind, et->gameboy);
+		}
+
+		// PPU continues in next buffer. Lines changed since that buffer was drawn into are
+		// converted first, so published frames are complete, also with frame skip
+		u32 changed[LIMEGUY_LINE_WORDS];
+		limeguy_take_changed_lines(et->gameboy, changed);
+		for (int ii = 0; ii < 3; ++ii) {
+			for (int jj = 0; jj < LIMEGUY_LINE_WORDS; ++jj)
+				fb->stale[ii][jj] |= ii == fb->back ? 0 : changed[jj];
+		}
+		frame_buffers_publish(fb);
+		limeguy_swap_output(et->gameboy, fb->pixels[fb->back], fb->stale[fb->back]);
+		memset(fb->stale[fb->back], 0, sizeof(fb->stale[fb->back]));
+
+		deadline.tv_nsec += frame_ns;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > deadline.tv_sec + 1) // way behind (e.g. debugger): don't try to catch up
+			deadline = now;
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+	}
+	__atomic_store_n(&et->finished, true, __ATOMIC_RELEASE);
+	return NULL;
 }
 
 int main(int argc, char* argv[]) {
-	FILE* logfile = NULL;
 	Texture dynamic_tex;
-	u8* rgba_pixels = NULL;
+	struct emu_thread emu = {0};
 	struct timespec start_time, end_time;
 
 	if (argc <= 1) {
@@ -164,113 +408,72 @@ int main(int argc, char* argv[]) {
 	}
 
 	struct gameboy* gameboy = gameboy_create(argv[argc - 1]);
+	limeguy_set_serial_echo(gameboy, true); // test ROMs report results over serial
+	ppu_set_frame_skip(gameboy->ppu, frame_skip);
+	if (fifo_renderer)
+		ppu_set_renderer(gameboy->ppu, PPU_RENDERER_FIFO);
+	if (!have_graphics) // nobody looks at the screen
+		ppu_set_render_on_demand(gameboy->ppu, true);
 
 	if (have_graphics) { // init raylib window
     	InitWindow(winWidth, winHeight, "Dynamic texture");
 
 		dynamic_tex = load_dynamic_texture(imgWidth, imgHeight);
-		rgba_pixels = malloc(imgWidth * imgHeight * 4); // pixel data
+		for (int ii = 0; ii < 3; ++ii)
+			emu.frames.pixels[ii] = calloc(imgWidth * imgHeight, 4);
+		emu.frames.back = 0;
+		emu.frames.shared = 1;
+		emu.frames.front = 2;
+		// PPU writes straight into back buffer, the others have no screen yet
+		limeguy_set_output(gameboy, emu.frames.pixels[emu.frames.back], imgWidth * 4, LIMEGUY_PIXFMT_RGBA8888, rgba_palette);
+		memset(emu.frames.stale, 0xFF, sizeof(emu.frames.stale));
+		memset(emu.frames.stale[emu.frames.back], 0, sizeof(emu.frames.stale[emu.frames.back]));
 
     	SetTargetFPS(fps);
 	}
-
-	bool break_hit = false;
-	bool done = false;
+	if (render_thread && !ppu_start_render_thread(gameboy->ppu))
+		fprintf(stderr, "Warning: could not start render thread\n");
 
 	clock_gettime(CLOCK_REALTIME, &start_time);
 
-	// "game" loop
-	while (!done && !cpu_is_stopped(gameboy->cpu)) {
-		if (have_graphics)
-			done = WindowShouldClose();
-
-		// Input
-		get_keyboard_input(gameboy);
-		// debug key
-		if (IsKeyPressed(KEY_D))
-			break_hit = true;
-
-		if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
-			Vector2 mouse_pos = GetMousePosition();
-			printf("x,y = %d, %d\n", (int)mouse_pos.x / pixScale, (int)mouse_pos.y / pixScale);
+	if (!have_graphics) {
+		// as fast as possible, on this thread
+		while (!cpu_is_stopped(gameboy->cpu) && !run_frame(gameboy))
+			;
+	}
+	else {
+		emu.gameboy = gameboy;
+		emu.rewind = limeguy_rewind_create(rewind_buffer_size, rewind_seconds * fps, fps);
+		bool emu_started = pthread_create(&emu.thread, NULL, emu_thread_run, &emu) == 0;
+		if (!emu_started) {
+			fprintf(stderr, "Error: could not start emulation thread\n");
+			emu.finished = true;
 		}
 
-		// TODO: How to define the exact "frame" loop?
-		// frame loop (run instrucutions until frame is done, or some max is exceeded)
-		bool frame_done = false;
-		cpu_reset_mcycle_frame(gameboy->cpu);
-		while (!done && !frame_done) { // Frame loop
-			// TODO: clean-up!! Especially interactive breakpoint code
-
-			if (logfile && gameboy->cpu->nr_instructions + 1 >= start_logging_instrnr)
-				write_log_line(gameboy, logfile);
-
-			// break point conditions
-			if (break_instrnr > 0 && gameboy->cpu->nr_instructions + 1 == break_instrnr)
-				break_hit = true;
-			if (break_addr >= 0 && gameboy->cpu->PC == break_addr)
-				break_hit = true;
-			if (gameboy->mem->io[0x03] != 0xFF) // unused IO addr used as break, when not read as 0xFF
-				break_hit = true;
-#ifdef INSTR_BREAK
-			if (cpu_get_opcode_at_pc(gameboy->cpu) == INSTR_BREAK) //break on LD B,B (mooneye test suite)
-				break_hit = true;
-#endif
-			if (break_hit) {
-				printf("\nInstr #: %u\n", gameboy->cpu->nr_instructions + 1);
-				cpu_print_info(gameboy->cpu);
-				ppu_print_info(gameboy->ppu);
-				char buf[80];
-				fgets(buf, 80, stdin);
-				if (buf[0] == 'q')
-					done = true; // causes program to exit
-				else if (buf[0] == 'c')
-					break_hit = false;
-				else if (buf[0] == 'm') {
-					u16 disp_addr = strtol(buf + 1, NULL, 16);
-					printf("Mem content: $%02X\n", mem_read(gameboy->mem, disp_addr));
-				}
-				else if (buf[0] == 'l' && !logfile) {
-					// Remove newline
-					char* bb = buf + 1;
-					while (*bb && *bb != '\n')
-						++bb;
-					*bb = '\0';
-					break_hit = false; // continue execution normally
-					logfile = fopen(buf + 1, "w");
-					if (!logfile)
-						fprintf(stderr, "Error: could not open log file %s\n", buf + 1);
-				}
-			}
+		// "game" loop: input and drawing only, emulation thread never waits for it
+		while (!WindowShouldClose() && !__atomic_load_n(&emu.finished, __ATOMIC_ACQUIRE)) {
+			get_keyboard_input(&emu.input);
 
-			cpu_run_instruction(gameboy->cpu);
-
-			// exit conditions
-			if (gameboy->cpu->nr_instructions == max_instr || (max_mcycles && gameboy->cpu->nr_mcycles >= max_mcycles))
-				done = true;
-			// we need to end frame at some point when LCD is off
-			if (cpu_get_mcycle_frame(gameboy->cpu) > 2 * mcycles_per_frame) // loads of margin...
-				frame_done = true;
-			// use ppu signaling hand-shake to see if frame is done
-			if (gameboy->ppu && ppu_frame_is_done(gameboy->ppu)) {
-				ppu_reset_frame_done(gameboy->ppu);
-				frame_done = true;
+			if (IsMouseButtonPressed(MOUSE_LEFT_BUTTON)) {
+				Vector2 mouse_pos = GetMousePosition();
+				printf("x,y = %d, %d\n", (int)mouse_pos.x / pixScale, (int)mouse_pos.y / pixScale);
 			}
-		} // end frame loop
 
-		if (have_graphics) {
-			ppu_lcd_to_rgba(gameboy->ppu, rgba_pixels, imgWidth, imgHeight, rgba_palette);
-			UpdateTexture(dynamic_tex, rgba_pixels);
+			if (frame_buffers_take(&emu.frames))
+				UpdateTexture(dynamic_tex, emu.frames.pixels[emu.frames.front]);
         	BeginDrawing();
         		ClearBackground(RAYWHITE); // Not needed
 				DrawTextureEx(dynamic_tex, (Vector2) {0, 0}, 0.0f, (float)pixScale, WHITE);
         		/*
         		DrawText(TextFormat("FPS: %d", GetFPS()), 10, 10, 30, RED);
-        		DrawText(TextFormat("Mcycles this frame: %d", cpu_get_mcycle_frame(cpu)), 10, 40, 30, RED);
         		*/
         	EndDrawing();
-		}
-	} // end game loop
+		} // end game loop
+
+		__atomic_store_n(&emu.quit, true, __ATOMIC_RELEASE);
+		if (emu_started)
+			pthread_join(emu.thread, NULL); // waits for debugger prompt, if any
+	}
 
 	clock_gettime(CLOCK_REALTIME, &end_time);
 	double elapsed_time = (double)(end_time.tv_sec - start_time.tv_sec) +
@@ -293,8 +496,10 @@ int main(int argc, char* argv[]) {
 	if (logfile)
 		fclose(logfile);
 	gameboy_destroy(gameboy);
+	limeguy_rewind_destroy(emu.rewind);
 	if (have_graphics) {
-    	free(rgba_pixels);
+		for (int ii = 0; ii < 3; ++ii)
+    		free(emu.frames.pixels[ii]);
     	UnloadTexture(dynamic_tex);
     	CloseWindow();                  // Close window and OpenGL context
 	}
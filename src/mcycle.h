@@ -11,8 +11,8 @@ struct mcycle {
 	struct mem*    mem;
 };
 
-struct mcycle* mcycle_create(struct timers* timers, struct ppu* ppu, struct mem* mem);
-void mcycle_destroy(struct mcycle* mcycle);
+// mcycle in caller memory (part of gameboy arena)
+void mcycle_init(struct mcycle* mcycle, struct timers* timers, struct ppu* ppu, struct mem* mem);
 
 void mcycle_tick(struct mcycle* mcycle);
 
@@ -2,10 +2,12 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "gameboy.h"
 #include "mem.h"
 
 #define VRAM          0x8000
+#define VRAM_SIZE     0x2000
 #define TILEDATA      0x8000
 #define TILEMAP       0x9800
 
@@ -66,18 +68,26 @@ struct io_init {
 
 #include "io_init.inc" // defines table io_init_dmg0[] 
 
-#define NR_TILES          384
-
 #define RAM_RESERVED      (32*1024)
+#define RAM_OFFSET        CACHE_ALIGN(sizeof(struct mem))
 //Next line is for when tiles are pre-computed, see note at mem_ppu_copy_tile_row
 //#define TILEDATA_RESERVED (NR_TILES * 8 * 8)
 
+size_t mem_arena_size(void) {
+	return CACHE_ALIGN(RAM_OFFSET + RAM_RESERVED/* + TILEDATA_RESERVED */);
+}
+
 struct mem* mem_create() {
 	// reverve one piece of mem for all (avoid many mallocs)
-	struct mem* mem = malloc(sizeof(struct mem) + RAM_RESERVED/* + TILEDATA_RESERVED */);
+	struct mem* mem = malloc(mem_arena_size());
+	mem_init(mem);
+	return mem;
+}
 
+void mem_init(struct mem* mem) {
 	mem->rom = NULL;
-	mem->ram = (u8*)((void*)mem + sizeof(struct mem)); // ram follows struct directly
+	mem->ppu = NULL;
+	mem->ram = (u8*)((void*)mem + RAM_OFFSET); // ram follows struct, on its own cache line
 	//mem->tiles = (u8*)((void*)mem->ram + RAM_RESERVED); // for "pre-decoded" tiles
 
 	// Init IO vals
@@ -97,14 +107,161 @@ struct mem* mem_create() {
 
 	mem->div_was_reset = false;
 	mem->button_state = 0;
+	mem->oam_changed = true;
+	mem->forward_writes = false;
+	mem->serial_count = 0;
+	mem->serial_byte = 0;
+	mem->serial_echo = false;
+	mem->watch_map = NULL;
+	mem->watch_hit = false;
+	mem->watch_addr = 0;
+	mem->samples = NULL;
+	for (int ii = 0; ii < NR_TILES; ++ii)
+		mem->tile_gen[ii] = 0;
+}
 
-	return mem;
+static
+void mem_free_samples(struct mem_samples* samples) {
+	if (!samples)
+		return;
+	free(samples->addrs);
+	free(samples->widths);
+	free(samples->data);
+	free(samples->changed);
+	free(samples->frames);
+	free(samples);
+}
+
+void mem_deinit(struct mem* mem) {
+	free(mem->watch_map);
+	mem_free_samples(mem->samples);
+	mem->watch_map = NULL;
+	mem->samples = NULL;
 }
 
 void mem_destroy(struct mem* mem) {
+	if (mem)
+		mem_deinit(mem);
 	free(mem);
 }
 
+void mem_relink(struct mem* mem) {
+	mem->ram = (u8*)((void*)mem + RAM_OFFSET);
+	mem->watch_map = NULL;
+	mem->samples = NULL;
+	mem->forward_writes = false; // render thread stays with original
+}
+
+size_t mem_state_size(void) {
+	return RAM_OFFSET + RAM_RESERVED;
+}
+
+void mem_save_state(struct mem* mem, void* buf) {
+	memcpy(buf, mem, RAM_OFFSET + RAM_RESERVED); // ram follows struct
+	STATE_CLEAR(buf, struct mem, rom);
+	STATE_CLEAR(buf, struct mem, ppu);
+	STATE_CLEAR(buf, struct mem, ram);
+	STATE_CLEAR(buf, struct mem, watch_map);
+	STATE_CLEAR(buf, struct mem, samples);
+}
+
+void mem_load_state(struct mem* mem, const void* buf) {
+	struct rom* rom = mem->rom;
+	struct ppu* ppu = mem->ppu;
+	bool forward_writes = mem->forward_writes;
+	bool serial_echo = mem->serial_echo;
+	u8* watch_map = mem->watch_map;
+	struct mem_samples* samples = mem->samples;
+	memcpy(mem, buf, RAM_OFFSET + RAM_RESERVED);
+	mem->rom = rom;
+	mem->ppu = ppu;
+	mem->ram = (u8*)((void*)mem + RAM_OFFSET);
+	mem->forward_writes = forward_writes;
+	mem->serial_echo = serial_echo;
+	mem->watch_map = watch_map;
+	mem->watch_hit = false;
+	mem->samples = samples;
+	mem->oam_changed = true;
+}
+
+void mem_set_watch(struct mem* mem, u16 addr, bool watch) {
+	if (addr >= ECHO_RAM && addr < ECHO_RAM + ECHO_RAM_SIZE) // writes are checked after translation
+		addr -= ECHO_RAM_OFFS;
+	if (!mem->watch_map) {
+		if (!watch)
+			return;
+		mem->watch_map = calloc(0x10000 / 8, 1);
+	}
+	if (watch)
+		mem->watch_map[addr >> 3] |= 1 << (addr & 7);
+	else
+		mem->watch_map[addr >> 3] &= ~(1 << (addr & 7));
+}
+
+bool mem_watch_hit(struct mem* mem, u16* addr) {
+	bool hit = mem->watch_hit;
+	if (hit && addr)
+		*addr = mem->watch_addr;
+	mem->watch_hit = false;
+	return hit;
+}
+
+bool mem_check_samples(const u16* addrs, const u8* widths, int nr_addrs, int nr_slots) {
+	if (nr_addrs <= 0)
+		return true;
+	if (nr_slots < 1)
+		return false;
+	for (int ii = 0; ii < nr_addrs; ++ii) {
+		if (widths[ii] != 1 && widths[ii] != 2 && widths[ii] != 4)
+			return false;
+		if (addrs[ii] + widths[ii] - 1 > 0xFFFF) // would wrap to 0000
+			return false;
+	}
+	return true;
+}
+
+bool mem_set_samples(struct mem* mem, const u16* addrs, const u8* widths, int nr_addrs, int nr_slots) {
+	if (!mem_check_samples(addrs, widths, nr_addrs, nr_slots))
+		return false;
+	mem_free_samples(mem->samples);
+	mem->samples = NULL;
+	if (nr_addrs <= 0)
+		return true;
+	int sample_size = 0;
+	for (int ii = 0; ii < nr_addrs; ++ii)
+		sample_size += widths[ii];
+
+	struct mem_samples* samples = malloc(sizeof(struct mem_samples));
+	samples->nr_addrs = nr_addrs;
+	samples->addrs = malloc(nr_addrs * sizeof(u16));
+	samples->widths = malloc(nr_addrs);
+	memcpy(samples->addrs, addrs, nr_addrs * sizeof(u16));
+	memcpy(samples->widths, widths, nr_addrs);
+	samples->sample_size = sample_size;
+	samples->changed_size = (nr_addrs + 7) / 8;
+	samples->nr_slots = nr_slots;
+	samples->data = calloc(nr_slots, sample_size);
+	samples->changed = calloc(nr_slots, samples->changed_size);
+	samples->frames = calloc(nr_slots, sizeof(unsigned int));
+	samples->nr_taken = 0;
+	mem->samples = samples;
+	return true;
+}
+
+bool mem_get_sample(struct mem* mem, unsigned int nr, void* data, u8* changed, unsigned int* frame) {
+	struct mem_samples* samples = mem->samples;
+	if (!samples || nr >= samples->nr_taken || samples->nr_taken - nr > (unsigned int)samples->nr_slots)
+		return false;
+	int slot = nr % samples->nr_slots;
+	if (data)
+		memcpy(data, &samples->data[slot * samples->sample_size], samples->sample_size);
+	if (changed)
+		memcpy(changed, &samples->changed[slot * samples->changed_size], samples->changed_size);
+	if (frame)
+		*frame = samples->frames[slot];
+	return true;
+}
+
 void mem_connect_rom(struct mem* mem, struct rom* rom) {
 	mem->rom = rom;
 }
@@ -113,6 +270,10 @@ void mem_disconnect_rom(struct mem* mem) {
 	mem->rom = NULL;
 }
 
+void mem_connect_ppu(struct mem* mem, struct ppu* ppu) {
+	mem->ppu = ppu;
+}
+
 u8 mem_read(struct mem* mem, u16 addr) {
 	bool is_oam = (addr >= OAM_START && addr < (OAM_START + OAM_SIZE));
 	if (mem->dma_active && is_oam)
@@ -153,7 +314,7 @@ u8 mem_read(struct mem* mem, u16 addr) {
 	else if (addr == INTERRUPT_ENABLE)
 		return mem->ie;
 	else
-		printf("Unhandled address read: addr = $%04X\n", addr);
+		fprintf(stderr, "Unhandled address read: addr = $%04X\n", addr);
 	return 0x66;
 }
 
@@ -163,21 +324,40 @@ u16 mem_read16(struct mem* mem, u16 addr) {
 	return (((u16)msbyte) << 8) | (u16)lsbyte;
 }
 
+static
+void mem_write_ppu_reg(struct mem* mem, u8 io_idx, enum ppu_reg reg, u8 value) {
+	mem->io[io_idx] = value;
+	if (mem->ppu) // for mid-scanline changes
+		ppu_log_reg_write(mem->ppu, reg, value);
+}
+
 void mem_write(struct mem* mem, u16 addr, u8 value) {
+	if (addr >= ECHO_RAM && addr < ECHO_RAM + ECHO_RAM_SIZE)
+		addr -= ECHO_RAM_OFFS;
+	if (mem->watch_map && ((mem->watch_map[addr >> 3] >> (addr & 7)) & 1)) {
+		mem->watch_hit = true;
+		mem->watch_addr = addr;
+	}
 	bool is_oam = (addr >= OAM_START && addr < (OAM_START + OAM_SIZE));
 	if (mem->dma_active && is_oam)
 		return;
-	if (addr >= ECHO_RAM && addr < ECHO_RAM + ECHO_RAM_SIZE)
-		addr -= ECHO_RAM_OFFS;
 
 	if (addr < VRAM) // ROM bank 00 & 01
 		rom_write(mem->rom, addr, value);
-	else if (addr >= VRAM && addr < ECHO_RAM)
+	else if (addr >= VRAM && addr < ECHO_RAM) {
 		mem->ram[addr - VRAM] = value; // includes echo RAM
+		if (addr < TILEMAP) // tile data: let PPU know tile changed
+			++mem->tile_gen[(addr - TILEDATA) >> 4];
+		if (mem->forward_writes && addr < VRAM + VRAM_SIZE)
+			ppu_log_mem_write(mem->ppu, addr, value);
+	}
 	else if (addr >= HIRAM_START && addr < (HIRAM_START + HIRAM_SIZE))
 		mem->hiram[addr - HIRAM_START] = value;
 	else if (is_oam) {
 		mem->oam[addr & 0xFF] = value;
+		mem->oam_changed = true;
+		if (mem->forward_writes)
+			ppu_log_mem_write(mem->ppu, addr, value);
 	}
 	else if (addr >= IO_START && addr < (IO_START + IO_SIZE)) { // IO operation
 		u8 io_idx = addr & 0xFF;
@@ -198,7 +378,10 @@ void mem_write(struct mem* mem, u16 addr, u8 value) {
 				break;
 			case IO_SC: // Serial out
 				if (value == 0x81) {
-					printf("%c", mem->io[IO_SB]);
+					if (mem->serial_echo)
+						printf("%c", mem->io[IO_SB]);
+					mem->serial_byte = mem->io[IO_SB];
+					++mem->serial_count;
 					mem->io[io_idx] = 0;
 				}
 				break;
@@ -208,6 +391,34 @@ void mem_write(struct mem* mem, u16 addr, u8 value) {
 				break;
 			case IO_LY: // read only
 				break;
+			case IO_LCDC:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_LCDC, value);
+				if (mem->ppu) // LCD on/off
+					ppu_resync(mem->ppu);
+				break;
+			case IO_LYC:
+				mem->io[io_idx] = value;
+				if (mem->ppu) // LY == LYC changes
+					ppu_resync(mem->ppu);
+				break;
+			case IO_SCY:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_SCY, value);
+				break;
+			case IO_SCX:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_SCX, value);
+				break;
+			case IO_BGP:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_BGP, value);
+				break;
+			case IO_OBP0:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_OBP0, value);
+				break;
+			case IO_OBP1:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_OBP1, value);
+				break;
+			case IO_WX:
+				mem_write_ppu_reg(mem, io_idx, PPU_REG_WX, value);
+				break;
 			default:
 				mem->io[io_idx] = value;
 		}
@@ -215,7 +426,7 @@ void mem_write(struct mem* mem, u16 addr, u8 value) {
 	else if (addr == INTERRUPT_ENABLE)
 		mem->ie = value;
 	else
-		printf("Unhandled address write: addr = $%04X\n", addr);
+		fprintf(stderr, "Unhandled address write: addr = $%04X\n", addr);
 }
 
 void mem_write16(struct mem* mem, u16 addr, u16 value) {
@@ -260,6 +471,9 @@ void mem_mcycle(struct mem* mem) {
 		else {
 			u8 value = mem_read(mem, mem->dma_addr);
 			mem->oam[addr_lo] = value;
+			mem->oam_changed = true;
+			if (mem->forward_writes)
+				ppu_log_mem_write(mem->ppu, OAM_START + addr_lo, value);
 			++mem->dma_addr;
 		}
 	}
@@ -327,9 +541,31 @@ u8 mem_ppu_get_lcdc(struct mem* mem) {
 	return mem->io[IO_LCDC];
 }
 
-void mem_ppu_get_scroll(struct mem* mem, u8* scx, u8* scy) {
-	if (scx) *scx = mem->io[IO_SCX];
-	if (scy) *scy = mem->io[IO_SCY];
+void mem_ppu_vblank(struct mem* mem, unsigned int frame) {
+	// one pass over the watch list. Previous sample is still in its slot (also with 1 slot:
+	// each value is compared before it is overwritten)
+	struct mem_samples* samples = mem->samples;
+	if (!samples)
+		return;
+	int slot = samples->nr_taken % samples->nr_slots;
+	int prev_slot = (samples->nr_taken + samples->nr_slots - 1) % samples->nr_slots;
+	u8* dest = &samples->data[slot * samples->sample_size];
+	const u8* prev = &samples->data[prev_slot * samples->sample_size];
+	u8* changed = &samples->changed[slot * samples->changed_size];
+	memset(changed, 0, samples->changed_size);
+	for (int ii = 0; ii < samples->nr_addrs; ++ii) {
+		bool differs = samples->nr_taken == 0;
+		for (int bb = 0; bb < samples->widths[ii]; ++bb) {
+			u8 value = mem_read(mem, samples->addrs[ii] + bb);
+			differs = differs || value != prev[bb];
+			dest[bb] = value;
+		}
+		changed[ii >> 3] |= differs << (ii & 7);
+		dest += samples->widths[ii];
+		prev += samples->widths[ii];
+	}
+	samples->frames[slot] = frame;
+	++samples->nr_taken;
 }
 
 void mem_ppu_get_wxwy(struct mem* mem, u8* wx, u8* wy) {
@@ -337,15 +573,15 @@ void mem_ppu_get_wxwy(struct mem* mem, u8* wx, u8* wy) {
 	if (wy) *wy = mem->io[IO_WY];
 }
 
-int mem_ppu_get_tileidx_from_tilemap(struct mem* mem, int tm_idx) {
-	// tm_idx already contains the offset created by LCDC.3
-	return mem->ram[(TILEMAP - VRAM) + tm_idx];
+const u8* mem_ppu_get_tilemap(struct mem* mem, int tile_map_sel) {
+	// tile_map_sel: 0 or 1 (LCDC.3 or LCDC.6)
+	return &mem->ram[(TILEMAP - VRAM) + tile_map_sel * 32 * 32];
+}
+
+const u32* mem_ppu_get_tile_gens(struct mem* mem) {
+	return mem->tile_gen;
 }
 
-// TODO: Try possible speed-up:
-// Draw all tiles in mem (array of tiles).
-// Update tile when VRAM tile data changes.
-// Copy from there directly.
 // TODO: Have start and end pixel nr as param? So we can copy subset of 8 pixel row?
 void mem_ppu_copy_tile_row(struct mem* mem, gb_color_idx* dest, int tile_idx_eff, int tile_row, bool fliplr) {
 	// tile_idx_eff: 0 .. 383 (LCDC.5 already processed)
@@ -362,34 +598,37 @@ void mem_ppu_copy_tile_row(struct mem* mem, gb_color_idx* dest, int tile_idx_eff
 	}
 }
 
-void mem_ppu_get_bg_palette(struct mem* mem, gb_color palette[4]) {
-	int bgp = mem->io[IO_BGP];
-	for (int ii = 0; ii < 4; ++ii) {
-		palette[ii] = bgp & 0x3;
-		bgp >>= 2;
-	}
+void mem_ppu_get_line_regs(struct mem* mem, u8 regs[NR_PPU_REGS]) {
+	regs[PPU_REG_LCDC] = mem->io[IO_LCDC];
+	regs[PPU_REG_SCY] = mem->io[IO_SCY];
+	regs[PPU_REG_SCX] = mem->io[IO_SCX];
+	regs[PPU_REG_BGP] = mem->io[IO_BGP];
+	regs[PPU_REG_OBP0] = mem->io[IO_OBP0];
+	regs[PPU_REG_OBP1] = mem->io[IO_OBP1];
+	regs[PPU_REG_WX] = mem->io[IO_WX];
 }
 
-void mem_ppu_get_obj_palettes(struct mem* mem, gb_color palettes[2 * 4]) {
-	int obp = mem->io[IO_OBP0];
-	for (int ii = 0; ii < 4; ++ii) {
-		palettes[ii] = obp & 0x3;
-		obp >>= 2;
-	}
-	obp = mem->io[IO_OBP1];
-	for (int ii = 4; ii < 8; ++ii) {
-		palettes[ii] = obp & 0x3;
-		obp >>= 2;
-	}
+const u8* mem_ppu_get_oam(struct mem* mem) {
+	return mem->oam;
+}
+
+void mem_ppu_forward_writes(struct mem* mem, bool forward) {
+	mem->forward_writes = forward && mem->ppu;
 }
 
-void mem_ppu_get_obj_attribs(struct mem* mem, struct obj_attributes* oa, int oam_idx) {
-	int offs = 4 * oam_idx;
-	oa->y = mem->oam[offs++];
-	oa->x = mem->oam[offs++];
-	oa->tile_idx = mem->oam[offs++];
-	oa->flags = mem->oam[offs];
-	oa->idx_in_oam = oam_idx;
+void mem_ppu_copy_video(struct mem* dest, struct mem* src) {
+	// copy VRAM and OAM, including tile generations (so PPU caches stay valid)
+	memcpy(dest->ram, src->ram, VRAM_SIZE);
+	memcpy(dest->oam, src->oam, OAM_SIZE);
+	memcpy(dest->tile_gen, src->tile_gen, sizeof(dest->tile_gen));
+	dest->oam_changed = true;
+}
+
+bool mem_ppu_oam_changed(struct mem* mem) {
+	// returns true when OAM was written since last call
+	bool oam_changed = mem->oam_changed;
+	mem->oam_changed = false;
+	return oam_changed;
 }
 
 void mem_set_button(struct mem* mem, enum gb_button but, bool pressed) {
@@ -398,3 +637,7 @@ void mem_set_button(struct mem* mem, enum gb_button but, bool pressed) {
 	// TODO: Interrupt?!
 }
 
+void mem_set_buttons(struct mem* mem, u8 buttons) {
+	mem->button_state = buttons;
+}
+
@@ -2,6 +2,7 @@
 #define __MEM_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "common.h"
 #include "rom.h"
 #include "ppu.h"
@@ -9,33 +10,94 @@
 
 // mem takes care of memory mapping
 
+#define NR_TILES 384
+
+// values of a list of addresses, gathered at every vblank into a ring of samples.
+// Sample: values back to back, little endian, width bytes each
+struct mem_samples {
+	int           nr_addrs;
+	u16*          addrs;
+	u8*           widths;      // 1, 2 or 4
+	int           sample_size; // bytes per sample
+	int           changed_size; // bytes per changed mask: bit per address (bit ii % 8 of byte ii / 8)
+	int           nr_slots;
+	u8*           data;        // nr_slots samples
+	u8*           changed;     // nr_slots masks: value differs from sample before
+	unsigned int* frames;      // nr_slots frame nrs (ppu nr_vblanks)
+	unsigned int  nr_taken;    // sample n is in slot n % nr_slots
+};
+
 struct mem {
+	// hot: used on every access
 	struct rom*     rom;
-	u8*             ram;
-	u8              oam[0xA0];
+	struct ppu*     ppu; // gets notified of writes to PPU registers
+	u8*             ram; // follows struct
+	u8*             watch_map; // memory watch: bit per address, set when written (NULL: no watches)
+	bool            forward_writes; // pass VRAM and OAM writes on to PPU (render thread)
+	u8              ie; // IE interrupt enbl flags. Note: IF is at io[0x0F]
 	u8              io[0x80];
 	u8              hiram[0x7F];
-	u8              ie; // IE interrupt enbl flags. Note: IF is at io[0x0F]
 
 	// DMA state
 	bool            dma_requested; // set when writing to 0xFF46
 	bool            dma_next_cycle; // hand-over bool to delay by one cycle
-	u16             dma_request_addres;
 	bool            dma_active;
+	u16             dma_request_addres;
 	u16             dma_addr;
 
 	bool            div_was_reset; // To allow syncing DIV timer to a write op
 
 	u8              button_state; // keeping copy of this simplifies interrupt gen, e.g.
 
+	bool            oam_changed; // tells PPU to rebuild its sprite index
+	u8              oam[0xA0];
+	u32             tile_gen[NR_TILES]; // incremented on each write to tile data, for PPU caching
+
+	// cold
+	bool            watch_hit;
+	u16             watch_addr; // address of last hit
+
+	// serial output
+	unsigned int    serial_count; // nr of bytes sent
+	u8              serial_byte;  // last byte sent
+	bool            serial_echo;  // print bytes sent to stdout
+
+	// RAM samples taken at every vblank (NULL: none)
+	struct mem_samples* samples;
+
 	//gb_color*   tiles; // For pre-decoded tiles
 };
 
 struct mem* mem_create();
 void mem_destroy(struct mem* mem);
 
+// mem in caller memory of mem_arena_size() bytes (part of gameboy arena). RAM follows struct
+size_t mem_arena_size(void);
+void mem_init(struct mem* mem);
+void mem_deinit(struct mem* mem); // frees watches and samples
+// mem was copied to another address: fix pointer to RAM, drop watches and samples (still
+// owned by the original)
+void mem_relink(struct mem* mem);
+
 void mem_connect_rom(struct mem* mem, struct rom* rom);
 void mem_disconnect_rom(struct mem* mem);
+void mem_connect_ppu(struct mem* mem, struct ppu* ppu);
+
+// save states: mem_load_state keeps connections (rom, ppu) of mem
+size_t mem_state_size(void);
+void mem_save_state(struct mem* mem, void* buf);
+void mem_load_state(struct mem* mem, const void* buf);
+
+// echo RAM and C000 - DDFF are one address: a watch on either catches writes through both
+void mem_set_watch(struct mem* mem, u16 addr, bool watch);
+bool mem_watch_hit(struct mem* mem, u16* addr); // clears hit
+
+// width 1, 2 or 4, not past FFFF, nr_slots >= 1 (anything for nr_addrs 0)
+bool mem_check_samples(const u16* addrs, const u8* widths, int nr_addrs, int nr_slots);
+// nr_addrs 0: stop sampling. Returns false on bad arguments (samples unchanged)
+bool mem_set_samples(struct mem* mem, const u16* addrs, const u8* widths, int nr_addrs, int nr_slots);
+// sample nr (see nr_taken). False when not taken yet, or overwritten
+bool mem_get_sample(struct mem* mem, unsigned int nr, void* data, u8* changed, unsigned int* frame);
 
 u8 mem_read(struct mem* mem, u16 addr);
 u16 mem_read16(struct mem* mem, u16 addr);
@@ -58,17 +120,21 @@ void mem_timers_tima_inc(struct mem* mem);
 
 // PPU interface
 void mem_ppu_report(struct mem* mem, int ly, int mode);
-void mem_ppu_get_scroll(struct mem* mem, u8* scx, u8* scy);
+void mem_ppu_vblank(struct mem* mem, unsigned int frame); // takes RAM sample
 void mem_ppu_get_wxwy(struct mem* mem, u8* wx, u8* wy);
 u8 mem_ppu_get_lcdc(struct mem* mem);
-int mem_ppu_get_tileidx_from_tilemap(struct mem* mem, int tm_idx);
+const u8* mem_ppu_get_tilemap(struct mem* mem, int tile_map_sel);
+const u32* mem_ppu_get_tile_gens(struct mem* mem);
 void mem_ppu_copy_tile_row(struct mem* mem, gb_color_idx* dest, int tile_idx_eff, int tile_row, bool fliplr);
-void mem_ppu_get_bg_palette(struct mem* mem, gb_color palette[4]);
-void mem_ppu_get_obj_palettes(struct mem* mem, gb_color palettes[2 * 4]);
-void mem_ppu_get_obj_attribs(struct mem* mem, struct obj_attributes* oa, int oam_idx);
+void mem_ppu_get_line_regs(struct mem* mem, u8 regs[NR_PPU_REGS]);
+const u8* mem_ppu_get_oam(struct mem* mem);
+void mem_ppu_forward_writes(struct mem* mem, bool forward);
+void mem_ppu_copy_video(struct mem* dest, struct mem* src);
+bool mem_ppu_oam_changed(struct mem* mem);
 
 // Buttons (kept in mem because of interrupt handling)
 void mem_set_button(struct mem* mem, enum gb_button but, bool pressed);
+void mem_set_buttons(struct mem* mem, u8 buttons); // bit (1 << enum gb_button) set: pressed
 
 
 #endif
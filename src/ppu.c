@@ -2,7 +2,12 @@
 // https://jsgroth.dev/blog/posts/gb-rewrite-pixel-fifo/
 
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
 #include "ppu.h"
+#include "ppu_fifo.h"
 #include "mem.h"
 
 //DEBUG
@@ -12,62 +17,328 @@
 #define LY_MAX       154
 #define XDOT_OAMSCAN 80
 #define XDOT_DRAW    252 /* debatable...*/
+#define XDOT_PIXEL0  (XDOT_OAMSCAN + 12) /* first pixel pushed to LCD */
 #define LY_VBLANK    144
 
+// render thread
+#define JOB_RING_SIZE  16  /* scanlines in flight */
+#define JOB_MAX_WRITES 256 /* VRAM/OAM writes per scanline, beyond that: copy all */
+#define JOB_SPINS      1000 /* render thread polls this often before going to sleep */
+
+enum render_job_type {
+	JOB_LINE,    // draw scanline
+	JOB_LCD_OFF, // LCD turned off
+	JOB_QUIT
+};
+
+struct mem_write_rec {
+	u16 addr;
+	u8  value;
+};
+
+struct render_job {
+	enum render_job_type type;
+	struct ppu_line      line;
+	int                  nr_writes; // VRAM/OAM writes to apply before drawing
+	struct mem_write_rec writes[JOB_MAX_WRITES];
+};
+
+// jobs are handed over in lock-free single producer, single consumer ring
+struct ppu_render_thread {
+	pthread_t            thread;
+	sem_t                wakeup;
+	bool                 sleeping; // render thread waits on semaphore
+	unsigned int         head; // next job to write, only written by emulation thread
+	unsigned int         tail; // next job to draw, only written by render thread
+	struct render_job    jobs[JOB_RING_SIZE];
+
+	struct mem*          shadow; // render thread copy of VRAM and OAM
+
+	// VRAM/OAM writes since last job
+	int                  nr_pending;
+	bool                 pending_overflow;
+	struct mem_write_rec pending[JOB_MAX_WRITES];
+};
+
 static
-void ppu_init(struct ppu* ppu) {
+void ppu_reset(struct ppu* ppu) {
 	ppu->xdot = 0;
 	ppu->ly = 0;
 	ppu->wy_condition = false;
 	ppu->wy_counter = 0;
 	ppu->last_line_rendered = -1;
+	ppu->line.reg_log_len = 0;
 	ppu->frame_done = false;
+	ppu->off_mcycles = 0;
+}
+
+static
+void ppu_invalidate_caches(struct ppu* ppu) {
+	for (int map = 0; map < NR_TILEMAPS; ++map)
+		for (int cell = 0; cell < TILEMAP_TILES; ++cell)
+			ppu->layers[map].tile_idx_eff[cell] = 0xFFFF;
+	ppu->obj_index_height = 0;
+}
+
+// arena: struct ppu, tilemap layers, fifo renderer state
+#define PPU_LAYERS_OFFSET CACHE_ALIGN(sizeof(struct ppu))
+#define PPU_FIFO_OFFSET   (PPU_LAYERS_OFFSET + CACHE_ALIGN(NR_TILEMAPS * sizeof(struct tilemap_layer)))
+
+size_t ppu_arena_size(void) {
+	return PPU_FIFO_OFFSET + CACHE_ALIGN(sizeof(struct ppu_fifo));
+}
+
+static
+struct ppu_fifo* ppu_fifo_storage(struct ppu* ppu) {
+	return (struct ppu_fifo*)((u8*)ppu + PPU_FIFO_OFFSET);
 }
 
-struct ppu* ppu_create(struct mem* mem) {
-	struct ppu* ppu = malloc(sizeof(struct ppu));
+void ppu_init(struct ppu* ppu, struct mem* mem) {
 	ppu->mem = mem;
-	ppu_init(ppu);
+	ppu_reset(ppu);
 	ppu->xdot = 100; // To pass mooneye boot check
 	ppu->ly = LY_MAX - 9; // To pass mooneye boot check
 	ppu->mode = PPU_MODE_HBLANK;
 	ppu->enabled = true;
+	ppu->resync = true; // evaluate LCDC, mode, etc. on first mcycle
+	ppu->obj_index_height = 0;
+	ppu->output.pixels = NULL;
+	ppu->render_thread = NULL;
+#ifdef PPU_PACKED_LCD
+	for (int y = 0; y < LCD_HEIGHT; ++y)
+		ppu->lcd_line_off[y] = false;
+#endif
+	memset(ppu->lcd, 0, sizeof(ppu->lcd));
+	memset(ppu->lines_changed, 0xFF, sizeof(ppu->lines_changed)); // nothing seen yet
+	ppu->mcycle = ppu_mcycle;
+	ppu->fifo = NULL;
+	ppu->layers = (struct tilemap_layer*)((u8*)ppu + PPU_LAYERS_OFFSET);
+	ppu_invalidate_caches(ppu);
+	ppu->frame_skip = 0;
+	ppu->skip_count = 0;
+	ppu->render_frame = true;
+	ppu->render_on_demand = false;
+	ppu->render_requested = false;
+	ppu->render_frame_nr = 0;
 	ppu->nr_frames = 0;
-	return ppu;
+	ppu->nr_vblanks = 0;
 }
 
-void ppu_destroy(struct ppu* ppu) {
-	free(ppu);
+void ppu_deinit(struct ppu* ppu) {
+	ppu_stop_render_thread(ppu);
+}
+
+void ppu_relink(struct ppu* ppu, struct mem* mem) {
+	ppu->mem = mem;
+	ppu->layers = (struct tilemap_layer*)((u8*)ppu + PPU_LAYERS_OFFSET);
+	if (ppu->fifo)
+		ppu->fifo = ppu_fifo_storage(ppu);
+	ppu->render_thread = NULL;
+	ppu->output.pixels = NULL;
+}
+
+static
+void ppu_draw_layer_tile(struct mem* mem, struct tilemap_layer* layer, int cell, int tile_idx_eff) {
+	gb_color_idx* dest = &layer->pixels[(cell / 32) * 8 * LAYER_SIZE + (cell % 32) * 8];
+	for (int tile_y = 0; tile_y < 8; ++tile_y)
+		mem_ppu_copy_tile_row(mem, &dest[tile_y * LAYER_SIZE], tile_idx_eff, tile_y, false);
 }
 
 static
-void ppu_draw_full_line_of_tilemap(gb_color_idx full_line[], int y, struct mem* mem, int tile_map_sel, bool addrmode8000) {
-	// tm_idx := tilemap * 32 * 32 + y/8 * 32 + x/8
-	int tm_idx_offset = tile_map_sel * 32 * 32 + (y / 8) * 32;
-	int tile_y = y % 8; // y in tile
-
-	// Create entire 32 tile BG scanline
-	for (int tilex = 0; tilex < 32; ++tilex) {
-		int tile_idx = mem_ppu_get_tileidx_from_tilemap(mem, tm_idx_offset + tilex); // as in tilemap
+const gb_color_idx* ppu_get_layer_line(struct ppu* ppu, struct mem* mem, int tile_map_sel, int y, int x, int width,
+                                       bool addrmode8000) {
+	// returns line y of tilemap layer, making sure tiles in [x, x + width) are up to date
+	struct tilemap_layer* layer = &ppu->layers[tile_map_sel];
+	const u8* tilemap = mem_ppu_get_tilemap(mem, tile_map_sel);
+	const u32* tile_gens = mem_ppu_get_tile_gens(mem);
+	int cell_offset = (y / 8) * 32;
+
+	for (int tilex = x / 8; tilex <= (x + width - 1) / 8; ++tilex) {
+		int cell = cell_offset + (tilex & 31); // wraps around
+		int tile_idx = tilemap[cell];
 		int tile_idx_eff = addrmode8000 ?  // oonverted to 0..383
 		                   tile_idx :
 		                   256 + (tile_idx & 0x7F) - (tile_idx & 0x80);
-		mem_ppu_copy_tile_row(mem, &full_line[tilex * 8], tile_idx_eff, tile_y, false);
+		if (layer->tile_idx_eff[cell] != tile_idx_eff || layer->tile_gen[cell] != tile_gens[tile_idx_eff]) {
+			ppu_draw_layer_tile(mem, layer, cell, tile_idx_eff);
+			layer->tile_idx_eff[cell] = tile_idx_eff;
+			layer->tile_gen[cell] = tile_gens[tile_idx_eff];
+		}
+	}
+	return &layer->pixels[y * LAYER_SIZE];
+}
+
+#ifdef PPU_PACKED_LCD
+// packed byte --> 4 colors
+#define UNPACK1(b)  { (b) & 3, ((b) >> 2) & 3, ((b) >> 4) & 3, ((b) >> 6) & 3 }
+#define UNPACK4(b)  UNPACK1(b), UNPACK1((b) + 1), UNPACK1((b) + 2), UNPACK1((b) + 3)
+#define UNPACK16(b) UNPACK4(b), UNPACK4((b) + 4), UNPACK4((b) + 8), UNPACK4((b) + 12)
+#define UNPACK64(b) UNPACK16(b), UNPACK16((b) + 16), UNPACK16((b) + 32), UNPACK16((b) + 48)
+static const gb_color unpack_lut[256][4] = { UNPACK64(0), UNPACK64(64), UNPACK64(128), UNPACK64(192) };
+#endif
+
+const gb_color* ppu_get_lcd_line(struct ppu* ppu, int y, gb_color buf[LCD_WIDTH]) {
+#ifdef PPU_PACKED_LCD
+	if (ppu->lcd_line_off[y])
+		memset(buf, COLOR_LCD_OFF, LCD_WIDTH);
+	else {
+		const u8* src = &ppu->lcd[y * LCD_LINE_BYTES];
+		for (int ii = 0; ii < LCD_LINE_BYTES; ++ii)
+			memcpy(&buf[ii * 4], unpack_lut[src[ii]], 4);
+	}
+	return buf;
+#else
+	(void)buf;
+	return &ppu->lcd[y * LCD_WIDTH];
+#endif
+}
+
+void ppu_store_lcd_line(struct ppu* ppu, int y, const gb_color src[LCD_WIDTH]) {
+	// store drawn line, keep track of lines that changed
+#ifdef PPU_PACKED_LCD
+	u8 packed[LCD_LINE_BYTES];
+	for (int ii = 0; ii < LCD_LINE_BYTES; ++ii, src += 4)
+		packed[ii] = src[0] | (src[1] << 2) | (src[2] << 4) | (src[3] << 6);
+	u8* dest = &ppu->lcd[y * LCD_LINE_BYTES];
+	if (!ppu->lcd_line_off[y] && memcmp(dest, packed, LCD_LINE_BYTES) == 0)
+		return;
+	memcpy(dest, packed, LCD_LINE_BYTES);
+	ppu->lcd_line_off[y] = false;
+#else
+	gb_color* dest = &ppu->lcd[y * LCD_WIDTH];
+	if (memcmp(dest, src, LCD_WIDTH) == 0)
+		return;
+	memcpy(dest, src, LCD_WIDTH);
+#endif
+	for (int rr = 0; rr < NR_PPU_LINES_READERS; ++rr)
+		ppu->lines_changed[rr][y / 32] |= 1u << (y % 32);
+}
+
+void ppu_take_changed_lines(struct ppu* ppu, enum ppu_lines_reader reader, u32 lines_changed[LCD_CHANGED_WORDS]) {
+	ppu_render_sync(ppu);
+	memcpy(lines_changed, ppu->lines_changed[reader], sizeof(ppu->lines_changed[reader]));
+	memset(ppu->lines_changed[reader], 0, sizeof(ppu->lines_changed[reader]));
+}
+
+void ppu_output_line(struct ppu* ppu, int y) {
+	// convert lcd line to output pixel format
+	gb_color buf[LCD_WIDTH];
+	const gb_color* src = ppu_get_lcd_line(ppu, y, buf);
+	void* dest = (u8*)ppu->output.pixels + y * ppu->output.pitch;
+	const uint32_t* lut = ppu->output.lut;
+	switch (ppu->output.format) {
+		case PPU_PIXFMT_RGBA8888:
+		case PPU_PIXFMT_BGRA8888: {
+			uint32_t* dest32 = dest;
+			for (int x = 0; x < LCD_WIDTH; ++x)
+				dest32[x] = lut[src[x]];
+			break;
+		}
+		case PPU_PIXFMT_RGB565: {
+			uint16_t* dest16 = dest;
+			for (int x = 0; x < LCD_WIDTH; ++x)
+				dest16[x] = lut[src[x]];
+			break;
+		}
+		case PPU_PIXFMT_GRAY8: {
+			u8* dest8 = dest;
+			for (int x = 0; x < LCD_WIDTH; ++x)
+				dest8[x] = lut[src[x]];
+			break;
+		}
+	}
+}
+
+static
+void ppu_output_frame(struct ppu* ppu) {
+	for (int y = 0; y < LCD_HEIGHT; ++y)
+		ppu_output_line(ppu, y);
+}
+
+void ppu_set_output(struct ppu* ppu, void* pixels, int pitch, enum ppu_pixel_format format,
+                    struct rgba_color rgba_palette[5]) {
+	ppu_render_sync(ppu); // render thread may be writing to output
+	ppu->output.pixels = pixels;
+	ppu->output.pitch = pitch;
+	ppu->output.format = format;
+	for (int ii = 0; ii < 5; ++ii) {
+		struct rgba_color c = rgba_palette[ii];
+		u8 bytes[4];
+		switch (format) {
+			case PPU_PIXFMT_RGBA8888:
+			case PPU_PIXFMT_BGRA8888:
+				bytes[0] = format == PPU_PIXFMT_RGBA8888 ? c.r : c.b;
+				bytes[1] = c.g;
+				bytes[2] = format == PPU_PIXFMT_RGBA8888 ? c.b : c.r;
+				bytes[3] = c.a;
+				memcpy(&ppu->output.lut[ii], bytes, 4); // byte order in memory, independent of endianness
+				break;
+			case PPU_PIXFMT_RGB565:
+				ppu->output.lut[ii] = ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+				break;
+			case PPU_PIXFMT_GRAY8:
+				ppu->output.lut[ii] = (77 * c.r + 150 * c.g + 29 * c.b) >> 8;
+				break;
+		}
 	}
+	if (pixels) // show current screen right away
+		ppu_output_frame(ppu);
 }
 
+void ppu_swap_output(struct ppu* ppu, void* pixels, const u32 lines[LCD_CHANGED_WORDS]) {
+	ppu_render_sync(ppu); // render thread may be writing to output
+	ppu->output.pixels = pixels;
+	if (!pixels)
+		return;
+	for (int y = 0; y < LCD_HEIGHT; ++y) {
+		if ((lines[y / 32] >> (y % 32)) & 1)
+			ppu_output_line(ppu, y);
+	}
+}
 
 static
-int cmp_obj_xpos_rev(const void* a, const void* b) {
-	struct obj_attributes* oa_a = (struct obj_attributes*)a;
-	struct obj_attributes* oa_b = (struct obj_attributes*)b;
-	return (oa_a->x != oa_b->x) ? oa_b->x - oa_a->x : oa_b->idx_in_oam - oa_a->idx_in_oam;
+void ppu_build_obj_index(struct ppu* ppu, struct mem* mem, int obj_height) {
+	// bucket objects by scanline: first 10 objects (in OAM order) per line are kept,
+	// sorted by descending x pos (so lowest x-pos overdraws previous one, for correct
+	// drawing priority). Equal x: descending OAM index
+	const u8* oam = mem_ppu_get_oam(mem);
+
+	for (int ly = 0; ly < LCD_HEIGHT; ++ly)
+		ppu->line_obj_count[ly] = 0;
+
+	for (int ii = 0; ii < NR_OBJS; ++ii) {
+		struct obj_attributes oa = {
+			.y = oam[4 * ii],
+			.x = oam[4 * ii + 1],
+			.tile_idx = oam[4 * ii + 2],
+			.flags = oam[4 * ii + 3],
+			.idx_in_oam = obj_height == 16 ? ii & 0xFE : ii // correct idx when using tile height 16
+		};
+		int ly_top = oa.y - 16; // we have 16 px margin on top, for hiding parts of objs
+		int ly_start = ly_top < 0 ? 0 : ly_top;
+		int ly_end = ly_top + obj_height < LCD_HEIGHT ? ly_top + obj_height : LCD_HEIGHT;
+		for (int ly = ly_start; ly < ly_end; ++ly) {
+			int nr_objs = ppu->line_obj_count[ly];
+			if (nr_objs == OBJS_PER_LINE) // we can draw 10 objs on one line
+				continue;
+			// insert, keeping line sorted
+			struct obj_attributes* objs = ppu->line_objs[ly];
+			int pos = nr_objs;
+			while (pos > 0 && (objs[pos - 1].x < oa.x ||
+			                   (objs[pos - 1].x == oa.x && objs[pos - 1].idx_in_oam < oa.idx_in_oam))) {
+				objs[pos] = objs[pos - 1];
+				--pos;
+			}
+			objs[pos] = oa;
+			ppu->line_obj_count[ly] = nr_objs + 1;
+		}
+	}
+	ppu->obj_index_height = obj_height;
 }
 
 static
-void ppu_draw_obj_line(gb_color_idx obj_line[], u8 obj_flags[], int y, struct mem* mem, int obj_height) {
-	int nr_objs = 0; // nr of objects on this line
-	struct obj_attributes obj_attribs[10]; // we can draw 10 objs on one line
+void ppu_draw_obj_line(struct ppu* ppu, struct mem* mem, gb_color_idx obj_line[], u8 obj_flags[], int y,
+                       int obj_height) {
 	gb_color_idx obj_tile_line[8];  // temporary space for tile line
 
 	int y16 = y + 16; // we have 16 px margin on top, for hiding parts of objs
@@ -76,23 +347,13 @@ void ppu_draw_obj_line(gb_color_idx obj_line[], u8 obj_flags[], int y, struct me
 	for (int ii = 0; ii < LCD_WIDTH; ++ii)
 		obj_line[ii] = 0; // transparent
 
-	// Step 1: get first 10 objects that have y-pos on this line
-	for (int ii = 0; ii < 40 && nr_objs < 10; ++ii) {
-		mem_ppu_get_obj_attribs(mem, &obj_attribs[nr_objs], ii);
-		// on this line?
-		if (obj_attribs[nr_objs].y <= y16 && y16 < obj_attribs[nr_objs].y + obj_height) {
-			// it's a keeper
-			if (obj_height == 16)
-				obj_attribs[nr_objs].idx_in_oam &= 0xFE; // correct idx when using tile height 16
-			++nr_objs;
-		}
-	}
+	// Step 1: get objects on this line, already in drawing order
+	if (mem_ppu_oam_changed(mem) || ppu->obj_index_height != obj_height)
+		ppu_build_obj_index(ppu, mem, obj_height);
+	int nr_objs = ppu->line_obj_count[y];
+	struct obj_attributes* obj_attribs = ppu->line_objs[y];
 
-	// Step 2: draw objects, from highest x-coord down (so lowest x-pos overdraws previous one,
-	// for correct drawing priority). We save objects prio bit in prio array
-	// Step 2a: sort, descending x pos
-	qsort(obj_attribs, nr_objs, sizeof(struct obj_attributes), cmp_obj_xpos_rev);
-	// Step 2b: draw each obj on obj_line, saving flags when drawing a pixel
+	// Step 2: draw each obj on obj_line, saving flags when drawing a pixel
 	for (int ii = 0; ii < nr_objs; ++ii) {
 		u8 flags = obj_attribs[ii].flags;
 		// get the tile row
@@ -117,92 +378,513 @@ void ppu_draw_obj_line(gb_color_idx obj_line[], u8 obj_flags[], int y, struct me
 }
 
 static
-void ppu_draw_scanline(struct ppu* ppu) {
-	u8 scx, scy, wx, lcdc;
-	// TODO: Merge into single scanline for speed (low prio for now)
-	gb_color_idx bg_line[32 * 8];
-	gb_color_idx win_line[32 * 8]; // TODO: 21 tiles is enough
+bool ppu_is_window_visible(bool wy_condition, u8 lcdc, u8 wx) {
+	// is window visible in this scanline?
+	bool bgwin_enbl = (lcdc >> 0) & 1;
+	return bgwin_enbl && wy_condition && wx <= 166 && ((lcdc >> 5) & 1) == 1;
+}
+
+static
+int ppu_line_next_segment(const struct ppu_line* line, u8 regs[NR_PPU_REGS], int* log_idx, int x_start) {
+	// Line is drawn in segments: register writes during mode 3 (reg_log) are
+	// used from their pixel column onwards. Applies writes at x_start, returns end of segment
+	while (*log_idx < line->reg_log_len && line->reg_log[*log_idx].x <= x_start) {
+		regs[line->reg_log[*log_idx].reg] = line->reg_log[*log_idx].value;
+		++*log_idx;
+	}
+	return *log_idx < line->reg_log_len ? line->reg_log[*log_idx].x : LCD_WIDTH;
+}
+
+static
+bool ppu_is_window_in_segment(const struct ppu_line* line, const u8 regs[NR_PPU_REGS], int x_end) {
+	u8 wx = regs[PPU_REG_WX];
+	return ppu_is_window_visible(line->wy_condition, regs[PPU_REG_LCDC], wx) && x_end + 7 > wx;
+}
+
+static
+bool ppu_line_has_window(const struct ppu_line* line) {
+	// does line draw window pixels (and increase window line counter)?
+	u8 regs[NR_PPU_REGS];
+	memcpy(regs, line->regs, sizeof(regs));
+	int log_idx = 0;
+	for (int x_start = 0; x_start < LCD_WIDTH; ) {
+		int x_end = ppu_line_next_segment(line, regs, &log_idx, x_start);
+		if (ppu_is_window_in_segment(line, regs, x_end))
+			return true;
+		x_start = x_end;
+	}
+	return false;
+}
+
+static
+void ppu_decode_palette(u8 palette_reg, gb_color palette[4]) {
+	for (int ii = 0; ii < 4; ++ii) {
+		palette[ii] = palette_reg & 0x3;
+		palette_reg >>= 2;
+	}
+}
+
+// inputs for combining bg/win and obj pixels of one segment
+struct ppu_mix_args {
+	const gb_color_idx* bg_line;  // full layer row
+	const gb_color_idx* win_line; // window row, starts at screen x = wx - 7
+	u8                  scx;
+	u8                  wx;
+	const gb_color_idx* obj_line;
+	const u8*           obj_flags;
+	gb_color            bg_palette[4];
+	gb_color            obj_palettes[2 * 4];
+};
+
+typedef void (*ppu_mix_fn)(gb_color* lcd_line, const struct ppu_mix_args* args, int x_start, int x_end);
+
+// index bits into ppu_mix_table
+#define MIX_BGWIN 1 /* LCDC bit 0 */
+#define MIX_OBJ   2 /* LCDC bit 1 */
+#define MIX_WIN   4 /* window visible in segment (implies MIX_BGWIN) */
+
+// one pixel: bg/win color index idx (already fetched) vs obj. BGWIN and OBJ are constants
+#define PPU_MIX_PIXEL(BGWIN, OBJ, idx) do { \
+		gb_color bgwin_col = (BGWIN) ? args->bg_palette[idx] : 0; /* WHITE when !bgwin_enbl */ \
+		if (!(OBJ) || args->obj_line[x] == 0) /* No obj here, draw bg/win */ \
+			lcd_line[x] = bgwin_col; \
+		else if (((args->obj_flags[x] >> 7) & 1) && idx != 0) /* prio: draw bg/win over obj instead */ \
+			lcd_line[x] = bgwin_col; \
+		else { /* draw obj pixel */ \
+			int palette_nr = (args->obj_flags[x] >> 4) & 1; \
+			lcd_line[x] = args->obj_palettes[palette_nr * 4 + args->obj_line[x]]; \
+		} \
+	} while (0)
+
+// Segment mixer specialized for one LCDC configuration: flags are compile time
+// constants, so the pixel loops carry no feature branches
+#define PPU_DEFINE_MIX(name, BGWIN, OBJ, WIN) \
+static \
+void name(gb_color* lcd_line, const struct ppu_mix_args* args, int x_start, int x_end) { \
+	int x_win = x_end; /* first window pixel */ \
+	if (WIN) { \
+		x_win = args->wx - 7; \
+		x_win = x_win < x_start ? x_start : (x_win > x_end ? x_end : x_win); \
+	} \
+	for (int x = x_start; x < x_win; ++x) { \
+		gb_color_idx idx = (BGWIN) ? args->bg_line[(x + args->scx) & 0xFF] : 0; \
+		PPU_MIX_PIXEL(BGWIN, OBJ, idx); \
+	} \
+	for (int x = x_win; x < x_end; ++x) { \
+		gb_color_idx idx = args->win_line[x + 7 - args->wx]; \
+		PPU_MIX_PIXEL(BGWIN, OBJ, idx); \
+	} \
+}
+
+PPU_DEFINE_MIX(ppu_mix_none, 0, 0, 0)
+PPU_DEFINE_MIX(ppu_mix_bg, 1, 0, 0)
+PPU_DEFINE_MIX(ppu_mix_obj, 0, 1, 0)
+PPU_DEFINE_MIX(ppu_mix_bg_obj, 1, 1, 0)
+PPU_DEFINE_MIX(ppu_mix_bg_win, 1, 0, 1)
+PPU_DEFINE_MIX(ppu_mix_bg_win_obj, 1, 1, 1)
+
+static const ppu_mix_fn ppu_mix_table[8] = {
+	ppu_mix_none,   ppu_mix_bg,     ppu_mix_obj,    ppu_mix_bg_obj,
+	ppu_mix_none,   ppu_mix_bg_win, ppu_mix_obj,    ppu_mix_bg_win_obj // window needs bgwin_enbl
+};
+
+static
+void ppu_draw_scanline(struct ppu* ppu, struct mem* mem, const struct ppu_line* line) {
+	// Line is drawn in segments, see ppu_line_next_segment
+	u8 regs[NR_PPU_REGS];
 	// obj line, and corresponding flags
 	gb_color_idx obj_line[LCD_WIDTH];
 	u8           obj_flags[LCD_WIDTH];
+	int          obj_line_height = 0; // 0: obj line not drawn yet
+
+	memcpy(regs, line->regs, sizeof(regs));
+	int log_idx = 0;
+	int x_start = 0;
+	gb_color lcd_line[LCD_WIDTH]; // stored in lcd when done
+
+	while (x_start < LCD_WIDTH) {
+		int x_end = ppu_line_next_segment(line, regs, &log_idx, x_start);
+
+		// positions of backround and window
+		u8 scx = regs[PPU_REG_SCX];
+		u8 scy = regs[PPU_REG_SCY];
+		u8 wx = regs[PPU_REG_WX]; // we don't need wy, handled by wy_condition
+
+		// extract data from LCDC
+		u8 lcdc = regs[PPU_REG_LCDC];
+		bool addrmode8000 = ((lcdc >> 4) & 1) == 1; // tile data addressing mode bg/win
+		int bg_tile_map = (lcdc >> 3) & 1;  // tile map 0 or 1
+		int win_tile_map = (lcdc >> 6) & 1; // tile map 0 or 1
+		int obj_height = 8 + ((lcdc >> 2) & 1) * 8;
+		bool obj_enbl = (lcdc >> 1) & 1;
+		bool bgwin_enbl = (lcdc >> 0) & 1;
+		bool win_enbl = ppu_is_window_in_segment(line, regs, x_end);
+
+		// lines from tilemap layers
+		const gb_color_idx* bg_line = NULL;
+		const gb_color_idx* win_line = NULL;
+
+		// Background and window
+		if (bgwin_enbl) { // background
+			int y_eff = (line->ly + scy) & 0xFF;
+			bg_line = ppu_get_layer_line(ppu, mem, bg_tile_map, y_eff, scx + x_start, x_end - x_start, addrmode8000);
+		}
+		if (win_enbl) { // window
+			// max is 7px + 160px
+			int win_x_start = x_start + 7 - wx > 0 ? x_start + 7 - wx : 0;
+			win_line = ppu_get_layer_line(ppu, mem, win_tile_map, line->wy_counter, win_x_start,
+			                              x_end + 7 - wx - win_x_start, addrmode8000);
+		}
+		if (obj_enbl && obj_line_height != obj_height) { // objects
+			ppu_draw_obj_line(ppu, mem, obj_line, obj_flags, line->ly, obj_height);
+			obj_line_height = obj_height;
+		}
 
-	// get positions of backround and window
-	mem_ppu_get_scroll(ppu->mem, &scx, &scy);
-	mem_ppu_get_wxwy(ppu->mem, &wx, NULL); // we don't need wy, handled by wy_condition
-
-	// extract data from LCDC
-	lcdc = mem_ppu_get_lcdc(ppu->mem);
-	bool addrmode8000 = ((lcdc >> 4) & 1) == 1; // tile data addressing mode bg/win
-	int bg_tile_map = (lcdc >> 3) & 1;  // tile map 0 or 1
-	int win_tile_map = (lcdc >> 6) & 1; // tile map 0 or 1
-	int obj_height = 8 + ((lcdc >> 2) & 1) * 8;
-	bool obj_enbl = (lcdc >> 1) & 1;
-	bool bgwin_enbl = (lcdc >> 0) & 1;
-	// win_enbl: is window visible in this scanline?
-	bool win_enbl = bgwin_enbl && ppu->wy_condition && wx <= 166 && ((lcdc >> 5) & 1) == 1;
+		// Get palette into LUT array
+		struct ppu_mix_args args;
+		ppu_decode_palette(regs[PPU_REG_BGP], args.bg_palette);
+		ppu_decode_palette(regs[PPU_REG_OBP0], &args.obj_palettes[0]);
+		ppu_decode_palette(regs[PPU_REG_OBP1], &args.obj_palettes[4]);
+		args.bg_line = bg_line;
+		args.win_line = win_line;
+		args.scx = scx;
+		args.wx = wx;
+		args.obj_line = obj_line;
+		args.obj_flags = obj_flags;
+
+		// Multiplex to lcd screen bitmap, and apply palette
+		int mix_idx = (bgwin_enbl ? MIX_BGWIN : 0) | (obj_enbl ? MIX_OBJ : 0) | (win_enbl ? MIX_WIN : 0);
+		ppu_mix_table[mix_idx](lcd_line, &args, x_start, x_end);
+
+		x_start = x_end;
+	}
+	ppu_store_lcd_line(ppu, line->ly, lcd_line);
+
+	if (ppu->output.pixels)
+		ppu_output_line(ppu, line->ly);
+}
 
-	// Background and window
-	if (bgwin_enbl) { // background
-		int y_eff = (ppu->ly + scy) & 0xFF;
-		ppu_draw_full_line_of_tilemap(bg_line, y_eff, ppu->mem, bg_tile_map, addrmode8000);
+static
+void ppu_clear_lcd(struct ppu* ppu) {
+	// LCD turned off: make screen whiter-than-white
+#ifdef PPU_PACKED_LCD
+	for (int y = 0; y < LCD_HEIGHT; ++y)
+		ppu->lcd_line_off[y] = true;
+#else
+	for (int ii = 0; ii < LCD_WIDTH * LCD_HEIGHT; ++ii)
+		ppu->lcd[ii] = COLOR_LCD_OFF;
+#endif
+	memset(ppu->lines_changed, 0xFF, sizeof(ppu->lines_changed));
+	if (ppu->output.pixels)
+		ppu_output_frame(ppu);
+}
+
+static
+void ppu_render_thread_wait(struct ppu_render_thread* rt) {
+	// poll for a while (jobs arrive every scanline), then sleep until woken by producer
+	int spins = 0;
+	while (__atomic_load_n(&rt->head, __ATOMIC_ACQUIRE) == rt->tail) {
+		if (spins++ < JOB_SPINS) {
+			sched_yield();
+			continue;
+		}
+		__atomic_store_n(&rt->sleeping, true, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&rt->head, __ATOMIC_SEQ_CST) != rt->tail) {
+			__atomic_store_n(&rt->sleeping, false, __ATOMIC_SEQ_CST);
+			break;
+		}
+		sem_wait(&rt->wakeup); // may return for stale post: loop checks again
 	}
-	if (win_enbl) { // window
-		// TODO: no need to get entire 32 tile line, max is 7px + 160px, so 21 tiles is enough
-		ppu_draw_full_line_of_tilemap(win_line, ppu->wy_counter, ppu->mem, win_tile_map, addrmode8000);
-		++ppu->wy_counter;
+}
+
+static
+void* ppu_render_thread_run(void* arg) {
+	struct ppu* ppu = arg;
+	struct ppu_render_thread* rt = ppu->render_thread;
+	for (;;) {
+		ppu_render_thread_wait(rt);
+		struct render_job* job = &rt->jobs[rt->tail % JOB_RING_SIZE];
+		if (job->type == JOB_QUIT)
+			break;
+		for (int ii = 0; ii < job->nr_writes; ++ii)
+			mem_write(rt->shadow, job->writes[ii].addr, job->writes[ii].value);
+		if (job->type == JOB_LINE)
+			ppu_draw_scanline(ppu, rt->shadow, &job->line);
+		else
+			ppu_clear_lcd(ppu);
+		__atomic_store_n(&rt->tail, rt->tail + 1, __ATOMIC_RELEASE);
 	}
-	if (obj_enbl) { // objects
-		ppu_draw_obj_line(obj_line, obj_flags, ppu->ly, ppu->mem, obj_height);
+	return NULL;
+}
+
+static
+void ppu_push_render_job(struct ppu* ppu, enum render_job_type type) {
+	struct ppu_render_thread* rt = ppu->render_thread;
+	if (rt->pending_overflow) { // too many writes to record: copy all once render thread is idle
+		ppu_render_sync(ppu);
+		mem_ppu_copy_video(rt->shadow, ppu->mem);
+		rt->nr_pending = 0;
+		rt->pending_overflow = false;
 	}
+	// wait for free slot (render thread is behind)
+	while (rt->head - __atomic_load_n(&rt->tail, __ATOMIC_ACQUIRE) == JOB_RING_SIZE)
+		sched_yield();
+
+	struct render_job* job = &rt->jobs[rt->head % JOB_RING_SIZE];
+	job->type = type;
+	if (type == JOB_LINE)
+		job->line = ppu->line;
+	memcpy(job->writes, rt->pending, rt->nr_pending * sizeof(struct mem_write_rec));
+	job->nr_writes = rt->nr_pending;
+	rt->nr_pending = 0;
+	__atomic_store_n(&rt->head, rt->head + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&rt->sleeping, false, __ATOMIC_SEQ_CST))
+		sem_post(&rt->wakeup);
+}
 
-	// Get palette into LUT array
-	gb_color bg_palette[4];
-	gb_color obj_palettes[2 * 4];
-	mem_ppu_get_bg_palette(ppu->mem, bg_palette);
-	mem_ppu_get_obj_palettes(ppu->mem, obj_palettes);
-
-	// Multiplex to lcd screen bitmap, and apply palette
-	int screen_offset = ppu->ly * LCD_WIDTH;
-	for (int x = 0; x < LCD_WIDTH; ++x) {
-		int x_bg = (x + scx) & 0xFF;
-		bool is_win = win_enbl && x + 7 >= wx;
-		gb_color_idx bgwin_col_idx = bgwin_enbl ? (is_win ? win_line[x + 7 - wx] : bg_line[x_bg]) : 0;
-		gb_color bgwin_col = bgwin_enbl ? bg_palette[bgwin_col_idx] : 0; // WHITE when !bgwin_enbl
-		// BG/WIN vs OBJ
-		if (!obj_enbl || obj_line[x] == 0) // No obj here, draw bg/win
-			ppu->lcd[screen_offset + x] = bgwin_col;
-		else { // there is obj pixel here
-			bool prio = ((obj_flags[x] >> 7) & 1) == 1;
-			if (prio && bgwin_col_idx != 0) // draw bg/win over obj instead
-				ppu->lcd[screen_offset + x] = bgwin_col;
-			else { // draw obj pixel
-				int palette_nr = (obj_flags[x] >> 4) & 1;
-				ppu->lcd[screen_offset + x] = obj_palettes[palette_nr * 4 + obj_line[x]];
-			}
-		}
+bool ppu_start_render_thread(struct ppu* ppu) {
+	if (ppu->render_thread)
+		return true;
+	if (ppu->fifo) // dot accurate renderer draws while emulating
+		return false;
+	struct ppu_render_thread* rt = malloc(sizeof(struct ppu_render_thread));
+	rt->head = 0;
+	rt->tail = 0;
+	rt->nr_pending = 0;
+	rt->pending_overflow = false;
+	rt->shadow = mem_create();
+	mem_ppu_copy_video(rt->shadow, ppu->mem);
+	rt->sleeping = false;
+	sem_init(&rt->wakeup, 0, 0);
+	ppu->render_thread = rt;
+	if (pthread_create(&rt->thread, NULL, ppu_render_thread_run, ppu) != 0) {
+		ppu->render_thread = NULL;
+		sem_destroy(&rt->wakeup);
+		mem_destroy(rt->shadow);
+		free(rt);
+		return false;
 	}
+	mem_ppu_forward_writes(ppu->mem, true);
+	return true;
+}
 
+void ppu_stop_render_thread(struct ppu* ppu) {
+	struct ppu_render_thread* rt = ppu->render_thread;
+	if (!rt)
+		return;
+	ppu_push_render_job(ppu, JOB_QUIT);
+	pthread_join(rt->thread, NULL);
+	mem_ppu_forward_writes(ppu->mem, false);
+	ppu->render_thread = NULL;
+	sem_destroy(&rt->wakeup);
+	mem_destroy(rt->shadow);
+	free(rt);
+}
+
+void ppu_render_sync(struct ppu* ppu) {
+	struct ppu_render_thread* rt = ppu->render_thread;
+	if (!rt)
+		return;
+	while (__atomic_load_n(&rt->tail, __ATOMIC_ACQUIRE) != rt->head)
+		sched_yield();
+}
+
+void ppu_log_mem_write(struct ppu* ppu, u16 addr, u8 value) {
+	struct ppu_render_thread* rt = ppu->render_thread;
+	if (rt->nr_pending == JOB_MAX_WRITES) {
+		rt->pending_overflow = true;
+		return;
+	}
+	rt->pending[rt->nr_pending].addr = addr;
+	rt->pending[rt->nr_pending].value = value;
+	++rt->nr_pending;
+}
+
+static
+void ppu_end_scanline(struct ppu* ppu) {
+	// end of mode 3: draw line (unless frame is skipped), keep window line counter in sync
+	if (ppu->render_frame) {
+		if (ppu->render_thread)
+			ppu_push_render_job(ppu, JOB_LINE);
+		else
+			ppu_draw_scanline(ppu, ppu->mem, &ppu->line);
+	}
+	if (ppu_line_has_window(&ppu->line))
+		++ppu->wy_counter;
 	ppu->last_line_rendered = ppu->ly;
 }
 
-void ppu_mcycle(struct ppu* ppu) {
-	// called every CPU cycle.
-	// Takes care of updating xdot and ly, setting mode, calling scan line draw
+void ppu_start_frame(struct ppu* ppu) {
+	// decide if this frame gets drawn
+	if (ppu->render_on_demand) {
+		ppu->render_frame = ppu->render_requested && ppu->render_frame_nr == ppu->nr_frames;
+		if (ppu->render_frame)
+			ppu->render_requested = false;
+	}
+	else if (ppu->skip_count > 0) {
+		--ppu->skip_count;
+		ppu->render_frame = false;
+	}
+	else {
+		ppu->skip_count = ppu->frame_skip;
+		ppu->render_frame = true;
+	}
+}
+
+void ppu_set_frame_skip(struct ppu* ppu, int frame_skip) {
+	ppu->frame_skip = frame_skip > 0 ? frame_skip : 0;
+	ppu->skip_count = ppu->skip_count < ppu->frame_skip ? ppu->skip_count : ppu->frame_skip;
+}
+
+void ppu_set_render_on_demand(struct ppu* ppu, bool on_demand) {
+	ppu->render_on_demand = on_demand;
+	ppu->render_requested = false;
+}
+
+void ppu_request_render(struct ppu* ppu) {
+	ppu_request_render_frame(ppu, ppu->nr_frames + 1);
+}
+
+void ppu_request_render_frame(struct ppu* ppu, unsigned int frame_nr) {
+	ppu->render_requested = true;
+	ppu->render_frame_nr = frame_nr;
+}
+
+void ppu_log_reg_write(struct ppu* ppu, enum ppu_reg reg, u8 value) {
+	// only writes during mode 3 of a line that is going to be drawn matter. Log is sized so it
+	// doesn't fill up, the check only guards against overflow
+	if (ppu->mode != PPU_MODE_DRAW || !ppu->render_frame || ppu->line.reg_log_len == REG_LOG_SIZE)
+		return;
+	int x = ppu->xdot - XDOT_PIXEL0;
+	struct ppu_reg_write* w = &ppu->line.reg_log[ppu->line.reg_log_len++];
+	w->x = x < 0 ? 0 : x > LCD_WIDTH ? LCD_WIDTH : x;
+	w->reg = reg;
+	w->value = value;
+}
+
+void ppu_resync(struct ppu* ppu) {
+	ppu->resync = true;
+}
+
+static
+void ppu_set_next_event(struct ppu* ppu) {
+	// dot at which mode or LY changes next
+	ppu->next_event_xdot = ppu->ly >= LY_VBLANK     ? XDOT_MAX :
+	                       ppu->xdot < XDOT_OAMSCAN ? XDOT_OAMSCAN :
+	                       ppu->xdot < XDOT_DRAW    ? XDOT_DRAW :
+	                                                  XDOT_MAX;
+}
+
+bool ppu_update_enabled(struct ppu* ppu) {
+	// LCDC or LYC written: check LCD enable. Returns false if LCD is off
+	ppu->resync = false;
 	bool enbl_prev = ppu->enabled;
 	ppu->enabled = (mem_ppu_get_lcdc(ppu->mem) >> 7) == 1;
 	if (enbl_prev && !ppu->enabled) { // LCD just turned off: make screen whiter-than-white
-		for (int ii = 0; ii < LCD_WIDTH * LCD_HEIGHT; ++ii)
-			ppu->lcd[ii] = COLOR_LCD_OFF;
-		ppu_init(ppu);
+		if (ppu->render_thread)
+			ppu_push_render_job(ppu, JOB_LCD_OFF);
+		else
+			ppu_clear_lcd(ppu);
+		int frame_mcycles = (ppu->ly * XDOT_MAX + ppu->xdot) / 4;
+		ppu_reset(ppu);
+		ppu->off_mcycles = frame_mcycles; // frame in progress goes on while off
 		ppu->mode = PPU_MODE_HBLANK;
 		mem_ppu_report(ppu->mem, ppu->ly, (int)ppu->mode);
-		return;
 	}
-	if (!ppu->enabled)
+	return ppu->enabled;
+}
+
+void ppu_set_renderer(struct ppu* ppu, enum ppu_renderer renderer) {
+	if (renderer == PPU_RENDERER_FIFO) {
+		ppu_stop_render_thread(ppu);
+		if (!ppu->fifo)
+			ppu->fifo = ppu_fifo_init(ppu_fifo_storage(ppu));
+		ppu->mcycle = ppu_fifo_mcycle;
+	}
+	else {
+		ppu->fifo = NULL;
+		ppu->mcycle = ppu_mcycle;
+	}
+	// start over from a mode boundary
+	ppu->resync = true;
+}
+
+size_t ppu_state_size(void) {
+	return sizeof(struct ppu) + sizeof(struct ppu_fifo);
+}
+
+void ppu_save_state(struct ppu* ppu, void* buf) {
+	ppu_render_sync(ppu);
+	memcpy(buf, ppu, sizeof(struct ppu));
+	STATE_CLEAR(buf, struct ppu, mem);
+	STATE_CLEAR(buf, struct ppu, mcycle);
+	STATE_CLEAR(buf, struct ppu, fifo);
+	STATE_CLEAR(buf, struct ppu, render_thread);
+	STATE_CLEAR(buf, struct ppu, output);
+	STATE_CLEAR(buf, struct ppu, layers);
+	void* fifo_buf = (u8*)buf + sizeof(struct ppu);
+	if (ppu->fifo)
+		memcpy(fifo_buf, ppu->fifo, sizeof(struct ppu_fifo));
+	else
+		memset(fifo_buf, 0, sizeof(struct ppu_fifo));
+}
+
+void ppu_load_state(struct ppu* ppu, const void* buf) {
+	struct mem* mem = ppu->mem;
+	void (*mcycle)(struct ppu* ppu) = ppu->mcycle;
+	struct ppu_fifo* fifo = ppu->fifo;
+	struct tilemap_layer* layers = ppu->layers;
+	struct ppu_output output = ppu->output;
+	int frame_skip = ppu->frame_skip;
+	bool render_on_demand = ppu->render_on_demand;
+	memcpy(ppu, buf, sizeof(struct ppu));
+	ppu->mem = mem;
+	ppu->mcycle = mcycle;
+	ppu->fifo = fifo;
+	ppu->render_thread = NULL;
+	ppu->layers = layers;
+	ppu->output = output;
+	ppu->frame_skip = frame_skip;
+	ppu->render_on_demand = render_on_demand;
+	if (ppu->fifo) // state of line renderer has zeroed fifo: starts drawing at next line
+		memcpy(ppu->fifo, (const u8*)buf + sizeof(struct ppu), sizeof(struct ppu_fifo));
+	ppu_invalidate_caches(ppu); // tile generations in VRAM changed
+	memset(ppu->lines_changed, 0xFF, sizeof(ppu->lines_changed)); // whole screen replaced
+	if (ppu->output.pixels)
+		ppu_output_frame(ppu);
+}
+
+void ppu_vblank(struct ppu* ppu) {
+	++ppu->nr_vblanks;
+	mem_ppu_vblank(ppu->mem, ppu->nr_vblanks);
+}
+
+void ppu_lcd_off_mcycle(struct ppu* ppu) {
+	// LCD off: frames keep their length, so frame timing stays the same for the emulator user
+	if (++ppu->off_mcycles < MCYCLES_PER_FRAME)
 		return;
+	ppu->off_mcycles = 0;
+	ppu_vblank(ppu);
+	ppu->frame_done = true;
+	++ppu->nr_frames;
+	ppu_start_frame(ppu);
+}
+
+void ppu_mcycle(struct ppu* ppu) {
+	// called every CPU cycle.
+	// Takes care of updating xdot and ly, setting mode, calling scan line draw.
+	// Nothing changes between mode / LY boundaries, unless LCDC or LYC are written (resync)
+	if (ppu->resync && ppu_update_enabled(ppu))
+		ppu->next_event_xdot = 0; // re-evaluate now
+	if (!ppu->enabled) { // LCD off: sleep until LCDC written. Counts the mcycle it went off too
+		ppu_lcd_off_mcycle(ppu);
+		return;
+	}
 
 	// one mcycle --> 4 dots (2 dots if cpu in double speed)
 	ppu->xdot += mem_is_cpu_double_speed(ppu->mem) ? 2 : 4;
+	if (ppu->xdot < ppu->next_event_xdot)
+		return;
 
 	if (ppu->xdot >= XDOT_MAX) {
 		++ppu->ly;
@@ -210,6 +892,7 @@ void ppu_mcycle(struct ppu* ppu) {
 			ppu->ly -= LY_MAX;
 			ppu->frame_done = true;
 			++ppu->nr_frames;
+			ppu_start_frame(ppu);
 		}
 		ppu->xdot -= XDOT_MAX;
 	}
@@ -219,9 +902,12 @@ void ppu_mcycle(struct ppu* ppu) {
 	            ppu->xdot < XDOT_OAMSCAN ? PPU_MODE_OAMSCAN :
 	            ppu->xdot < XDOT_DRAW    ? PPU_MODE_DRAW :
 	                                       PPU_MODE_HBLANK;
+	ppu_set_next_event(ppu);
 
 	if (ppu->mode != mode_prev) {
 		if (ppu->mode == PPU_MODE_VBLANK) {
+			if (ppu->ly == LY_VBLANK) // not when resynced halfway
+				ppu_vblank(ppu);
 			ppu->wy_condition = false;
 			ppu->wy_counter = 0;
 		}
@@ -230,26 +916,34 @@ void ppu_mcycle(struct ppu* ppu) {
 			mem_ppu_get_wxwy(ppu->mem, NULL, &wy);
 			ppu->wy_condition = ppu->wy_condition || wy == ppu->ly;
 		}
+		else if (ppu->mode == PPU_MODE_DRAW) { // remember registers, start logging writes
+			ppu->line.ly = ppu->ly;
+			mem_ppu_get_line_regs(ppu->mem, ppu->line.regs);
+			ppu->line.reg_log_len = 0;
+			ppu->line.wy_condition = ppu->wy_condition;
+			ppu->line.wy_counter = ppu->wy_counter;
+		}
 	}
 
 	// Update STAT and LY, set interrupt flags
 	mem_ppu_report(ppu->mem, ppu->ly, (int)ppu->mode);
 
-	// draw whole scanline during OAMSCAN (not like real hardware...)
-	if (ppu->mode != PPU_MODE_VBLANK && ppu->xdot >= 80 && ppu->ly != ppu->last_line_rendered) {
-		// TODO: keep record of some IO vars (like LCDC) per pixel!
-		ppu_draw_scanline(ppu);
-	}
+	// draw whole scanline at end of mode 3 (not like real hardware...), replaying
+	// register writes made during mode 3
+	if (ppu->mode == PPU_MODE_HBLANK && ppu->ly != ppu->last_line_rendered)
+		ppu_end_scanline(ppu);
 }
 
-void ppu_lcd_to_rgba(struct ppu* ppu, u8* pixels, int pixw, int pixh, struct limeguy_color rgba_palette[5]) {
+void ppu_lcd_to_rgba(struct ppu* ppu, u8* pixels, int pixw, int pixh, struct rgba_color rgba_palette[5]) {
+	ppu_render_sync(ppu);
 	int w = pixw < LCD_WIDTH ? pixw : LCD_WIDTH;
 	int h = pixh < LCD_HEIGHT ? pixh : LCD_HEIGHT;
 	for (int y = 0; y < h; ++y) {
-		int lcd_idx = y * LCD_WIDTH; // x = 0;
+		gb_color buf[LCD_WIDTH];
+		const gb_color* lcd_line = ppu_get_lcd_line(ppu, y, buf);
 		int pix_idx = 4 * (y * pixw); // 4 bytes per pixel, order: R G B A; x = 0
 		for (int x = 0; x < w; ++x) {
-			gb_color lcd_col = ppu->lcd[lcd_idx++];
+			gb_color lcd_col = lcd_line[x];
 			pixels[pix_idx++] = rgba_palette[lcd_col].r;
 			pixels[pix_idx++] = rgba_palette[lcd_col].g;
 			pixels[pix_idx++] = rgba_palette[lcd_col].b;
@@ -259,6 +953,8 @@ void ppu_lcd_to_rgba(struct ppu* ppu, u8* pixels, int pixw, int pixh, struct lim
 }
 
 bool ppu_frame_is_done(struct ppu* ppu) {
+	if (ppu->frame_done) // make sure last line is drawn
+		ppu_render_sync(ppu);
 	return ppu->frame_done;
 }
 
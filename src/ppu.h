@@ -2,15 +2,34 @@
 #define __PPU_H__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "common.h"
 
 #define LCD_WIDTH 160
 #define LCD_HEIGHT 144
 
+#define MCYCLES_PER_FRAME 17556 /* 154 lines * 456 dots / 4 */
+
 // LCD color code when screen off (5th color)
 #define COLOR_LCD_OFF 0x4
 
+// Build with -DPPU_PACKED_LCD to keep the screen at 2 bits per pixel (4 pixels
+// per byte, leftmost pixel in lowest bits): a quarter of the memory per instance.
+// Use ppu_get_lcd_line to read the screen in either case
+#ifdef PPU_PACKED_LCD
+#define LCD_LINE_BYTES (LCD_WIDTH / 4)
+#endif
+
+#define LCD_CHANGED_WORDS ((LCD_HEIGHT + 31) / 32)
+
+#define NR_TILEMAPS   2
+#define TILEMAP_TILES (32 * 32)
+#define LAYER_SIZE    256 /* width and height of full tilemap in pixels */
+
+#define NR_OBJS       40
+#define OBJS_PER_LINE 10
+
 enum ppu_mode {
 	PPU_MODE_HBLANK  = 0,
 	PPU_MODE_VBLANK  = 1,
@@ -18,44 +37,205 @@ enum ppu_mode {
 	PPU_MODE_DRAW    = 3
 };
 
+// registers that can change mid-scanline (raster effects)
+enum ppu_reg {
+	PPU_REG_LCDC = 0,
+	PPU_REG_SCY,
+	PPU_REG_SCX,
+	PPU_REG_BGP,
+	PPU_REG_OBP0,
+	PPU_REG_OBP1,
+	PPU_REG_WX,
+	NR_PPU_REGS
+};
+
+// register write during mode 3, replayed by scanline renderer
+// worst case: mode 3 is at most ~300 dots (75 M-cycles), an IO write (LD (C),A) takes 2 M-cycles
+#define REG_LOG_SIZE 40
+struct ppu_reg_write {
+	u8 x;     // pixel column from which new value is used
+	u8 reg;   // enum ppu_reg
+	u8 value;
+};
+
+// everything needed to draw one scanline (snapshot at start of mode 3)
+struct ppu_line {
+	int                  ly;
+	u8                   regs[NR_PPU_REGS]; // at start of mode 3
+	struct ppu_reg_write reg_log[REG_LOG_SIZE]; // writes during mode 3
+	int                  reg_log_len;
+	bool                 wy_condition;
+	int                  wy_counter;
+};
+
+// framebuffer owned by caller. PPU writes final pixels into it when a scanline is done
+struct ppu_output {
+	void*                 pixels; // NULL: no output target
+	int                   pitch;  // bytes per row
+	enum ppu_pixel_format format;
+	uint32_t              lut[5]; // lcd color (and off color) --> pixel value
+};
+
+// fully drawn tilemap (color indices). Tiles are redrawn lazily, when
+// tilemap entry, tile data or addressing mode changed
+struct tilemap_layer {
+	gb_color_idx pixels[LAYER_SIZE * LAYER_SIZE];
+	u16          tile_idx_eff[TILEMAP_TILES]; // tile drawn in this cell (0xFFFF: none)
+	u32          tile_gen[TILEMAP_TILES];     // tile data generation (see mem) when drawn
+};
+
+struct obj_attributes {
+	u8 y;
+	u8 x;
+	u8 tile_idx;
+	u8 flags; // see: https://gbdev.io/pandocs/OAM.html
+
+	u8 idx_in_oam; // for sorting when x's are equal
+};
+
+// users of the changed line bitmap, each takes (and clears) its own copy
+enum ppu_lines_reader {
+	PPU_LINES_FRONT_END = 0, // limeguy_take_changed_lines
+	PPU_LINES_FRAMEDELTA,
+	NR_PPU_LINES_READERS
+};
+
+// scanline renderer: fast line based, or dot accurate pixel FIFO (ppu_fifo.c)
+enum ppu_renderer {
+	PPU_RENDERER_LINE,
+	PPU_RENDERER_FIFO
+};
+
+struct ppu_render_thread; // see ppu.c
+struct ppu_fifo;          // see ppu_fifo.c
+
 struct ppu {
+	// hot: used every mcycle
 	struct mem*   mem;
+	void          (*mcycle)(struct ppu* ppu); // renderer: ppu_mcycle or ppu_fifo_mcycle
 	bool          enabled;
+	bool          resync; // LCDC or LYC written: re-evaluate on next mcycle
+	bool          frame_done; // set to true when ly goes back to 0
 	int           xdot; // 0 .. 455
 	int           ly;   // 0 .. 153
 	enum ppu_mode mode;
+	int           next_event_xdot; // xdot of next mode / LY change
+	int           off_mcycles; // LCD off: mcycles into virtual frame
+	unsigned int  nr_vblanks; // vblank starts. LCD off: counts virtual frames
 
-	gb_color      lcd[LCD_WIDTH * LCD_HEIGHT];
+	// dot accurate renderer state (NULL: line renderer)
+	struct ppu_fifo* fifo;
 
-	bool          frame_done; // set to true when ly goes back to 0
+	// pipelined rendering: scanlines are drawn on separate thread (NULL: not used)
+	struct ppu_render_thread* render_thread;
+
+#ifdef PPU_PACKED_LCD
+	u8            lcd[LCD_LINE_BYTES * LCD_HEIGHT];
+	bool          lcd_line_off[LCD_HEIGHT]; // line shows COLOR_LCD_OFF (does not fit in 2 bits)
+#else
+	gb_color      lcd[LCD_WIDTH * LCD_HEIGHT];
+#endif
+	u32           lines_changed[NR_PPU_LINES_READERS][LCD_CHANGED_WORDS]; // bit per line: changed since reader took it
+	struct ppu_output output;
 
 	// helper
 	int           last_line_rendered;
 
+	// line being drawn
+	struct ppu_line line;
+
 	// window
 	bool          wy_condition; // WY == LY
 	int           wy_counter;
 
-	// DEBUG
-	unsigned int nr_frames;
-};
+	// background / window cache, one per tilemap
+	struct tilemap_layer* layers;
 
-struct obj_attributes {
-	u8 y;
-	u8 x;
-	u8 tile_idx;
-	u8 flags; // see: https://gbdev.io/pandocs/OAM.html
+	// sprite index: objects per scanline, in drawing order. Rebuilt when OAM changes
+	struct obj_attributes line_objs[LCD_HEIGHT][OBJS_PER_LINE];
+	u8            line_obj_count[LCD_HEIGHT];
+	int           obj_index_height; // obj height used for index (0: invalid)
 
-	u8 idx_in_oam; // for sorting when x's are equal
+	// frame skip: timing runs as usual, but pixels are only drawn for rendered frames
+	int           frame_skip;   // nr of frames skipped after each rendered frame (0: draw all)
+	int           skip_count;   // frames left to skip
+	bool          render_frame; // false: current frame is skipped
+
+	// render on demand: only frames explicitly requested are drawn
+	bool          render_on_demand;
+	bool          render_requested;
+	unsigned int  render_frame_nr; // requested frame (compared to nr_frames)
+
+	// cold
+	// DEBUG
+	unsigned int nr_frames;
 };
 
-struct ppu* ppu_create(struct mem* mem);
-void ppu_destroy(struct ppu* ppu);
+// ppu in caller memory of ppu_arena_size() bytes (part of gameboy arena). Tilemap layers
+// and fifo renderer state follow struct
+size_t ppu_arena_size(void);
+void ppu_init(struct ppu* ppu, struct mem* mem);
+void ppu_deinit(struct ppu* ppu); // stops render thread
+// ppu was copied to another address: fix pointers into arena. Render thread and output
+// stay with the original
+void ppu_relink(struct ppu* ppu, struct mem* mem);
 
+// line renderer. Call ppu->mcycle to use selected renderer
 void ppu_mcycle(struct ppu* ppu);
 
+void ppu_set_renderer(struct ppu* ppu, enum ppu_renderer renderer);
+
+// save states: ppu_load_state keeps connections, renderer, output, frame skip and render on
+// demand settings of ppu.
+// Render thread must be stopped
+size_t ppu_state_size(void);
+void ppu_save_state(struct ppu* ppu, void* buf);
+void ppu_load_state(struct ppu* ppu, const void* buf);
+
+// called by mem on writes to registers in enum ppu_reg
+void ppu_log_reg_write(struct ppu* ppu, enum ppu_reg reg, u8 value);
+// called by mem on writes to LCDC and LYC
+void ppu_resync(struct ppu* ppu);
+
+// shared with ppu_fifo.c
+bool ppu_update_enabled(struct ppu* ppu);
+void ppu_lcd_off_mcycle(struct ppu* ppu);
+void ppu_vblank(struct ppu* ppu); // vblank started (LCD off: frame time passed)
+void ppu_start_frame(struct ppu* ppu);
+void ppu_output_line(struct ppu* ppu, int y);
+void ppu_store_lcd_line(struct ppu* ppu, int y, const gb_color src[LCD_WIDTH]);
+
+// draw scanlines on separate thread (line renderer only), overlapping with emulation. Returns false on failure
+bool ppu_start_render_thread(struct ppu* ppu);
+void ppu_stop_render_thread(struct ppu* ppu);
+// wait until render thread has drawn all scanlines handed to it
+void ppu_render_sync(struct ppu* ppu);
+// called by mem on writes to VRAM and OAM, while render thread runs
+void ppu_log_mem_write(struct ppu* ppu, u16 addr, u8 value);
+
+// render 1 out of every (frame_skip + 1) frames. Takes effect at start of next frame
+void ppu_set_frame_skip(struct ppu* ppu, int frame_skip);
+
+// render on demand: no frames drawn, except the ones requested
+void ppu_set_render_on_demand(struct ppu* ppu, bool on_demand);
+void ppu_request_render(struct ppu* ppu); // draw next frame
+void ppu_request_render_frame(struct ppu* ppu, unsigned int frame_nr); // draw frame when nr_frames == frame_nr
+
 // rgba_palette order: lcd col 0, lcd col 1, lcd col 2, lcd col 3, off color
-void ppu_lcd_to_rgba(struct ppu* ppu, u8* pixels, int pixw, int pixh, struct limeguy_color rgba_palette[5]);
+// pixels: aligned to pixel size of format, at least pitch * LCD_HEIGHT bytes. NULL: no output
+void ppu_set_output(struct ppu* ppu, void* pixels, int pitch, enum ppu_pixel_format format,
+                    struct rgba_color rgba_palette[5]);
+// other pixels, same pitch, format and palette: only lines set in lines are converted into them
+void ppu_swap_output(struct ppu* ppu, void* pixels, const u32 lines[LCD_CHANGED_WORDS]);
+void ppu_lcd_to_rgba(struct ppu* ppu, u8* pixels, int pixw, int pixh, struct rgba_color rgba_palette[5]);
+
+// screen line y, one gb_color per pixel. Returns pointer into lcd, or buf (unpacked)
+const gb_color* ppu_get_lcd_line(struct ppu* ppu, int y, gb_color buf[LCD_WIDTH]);
+
+// copy bitmap of lines changed since previous call by the same reader (bit y % 32 of word
+// y / 32), and clear it. Readers do not see each other's calls
+void ppu_take_changed_lines(struct ppu* ppu, enum ppu_lines_reader reader,
+                            u32 lines_changed[LCD_CHANGED_WORDS]);
 
 bool ppu_frame_is_done(struct ppu* ppu);
 void ppu_reset_frame_done(struct ppu* ppu);
@@ -0,0 +1,292 @@
+// Dot accurate PPU renderer, see ppu_fifo.h
+// https://jsgroth.dev/blog/posts/gb-rewrite-pixel-fifo/
+// https://gbdev.io/pandocs/pixel_fifo.html
+
+#include <stdlib.h>
+#include <string.h>
+#include "ppu.h"
+#include "ppu_fifo.h"
+#include "mem.h"
+
+#define XDOT_MAX        456
+#define LY_MAX          154
+#define XDOT_OAMSCAN    80
+#define LY_VBLANK       144
+#define FETCH_WARMUP    6 /* first tile of a line is fetched twice */
+#define OBJ_FETCH_DOTS  6
+
+struct ppu_fifo* ppu_fifo_init(struct ppu_fifo* fifo) {
+	memset(fifo, 0, sizeof(struct ppu_fifo));
+	fifo->obj_fetch = -1;
+	return fifo;
+}
+
+static
+void ppu_fifo_oam_scan(struct ppu* ppu, struct ppu_fifo* f) {
+	// select up to 10 objects on this line, in OAM order
+	const u8* oam = mem_ppu_get_oam(ppu->mem);
+	int obj_height = 8 + ((mem_ppu_get_lcdc(ppu->mem) >> 2) & 1) * 8;
+	int y16 = ppu->ly + 16;
+	f->nr_objs = 0;
+	for (int ii = 0; ii < NR_OBJS && f->nr_objs < OBJS_PER_LINE; ++ii) {
+		const u8* attr = &oam[ii * 4];
+		if (y16 < attr[0] || y16 >= attr[0] + obj_height)
+			continue;
+		struct obj_attributes* obj = &f->objs[f->nr_objs++];
+		obj->y = attr[0];
+		obj->x = attr[1];
+		obj->tile_idx = attr[2];
+		obj->flags = attr[3];
+		obj->idx_in_oam = ii;
+	}
+}
+
+static
+void ppu_fifo_start_line(struct ppu* ppu, struct ppu_fifo* f) {
+	// start of mode 3
+	u8 regs[NR_PPU_REGS];
+	mem_ppu_get_line_regs(ppu->mem, regs);
+	f->drawing = true;
+	for (int ii = 0; ii < OBJS_PER_LINE; ++ii)
+		f->obj_fetched[ii] = false;
+	f->obj_fetch = -1;
+	f->step = FETCH_TILE;
+	f->step_dots = 0;
+	f->warmup = FETCH_WARMUP;
+	f->fetch_x = 0;
+	f->win_active = false;
+	f->win_drawn = false;
+	f->bg_pos = 0;
+	f->bg_len = 0;
+	f->obj_head = 0;
+	f->obj_len = 0;
+	f->lx = 0;
+	f->discard = regs[PPU_REG_SCX] & 7;
+}
+
+static
+void ppu_fifo_fetch_dot(struct ppu* ppu, struct ppu_fifo* f, const u8 regs[NR_PPU_REGS]) {
+	// background / window fetcher: 3 steps of 2 dots, then push when bg FIFO is empty
+	if (f->step == FETCH_PUSH) {
+		if (f->bg_len == 0) {
+			memcpy(f->bg_fifo, f->tile_row, sizeof(f->bg_fifo));
+			f->bg_pos = 0;
+			f->bg_len = 8;
+			f->step = FETCH_TILE;
+			++f->fetch_x;
+		}
+		return;
+	}
+	if (f->step_dots == 0) {
+		u8 lcdc = regs[PPU_REG_LCDC];
+		if (f->step == FETCH_TILE) {
+			int map_sel, tilex, y;
+			if (f->win_active) {
+				map_sel = (lcdc >> 6) & 1;
+				tilex = f->fetch_x & 31;
+				y = ppu->wy_counter;
+			}
+			else {
+				map_sel = (lcdc >> 3) & 1;
+				tilex = ((regs[PPU_REG_SCX] >> 3) + f->fetch_x) & 31;
+				y = (ppu->ly + regs[PPU_REG_SCY]) & 0xFF;
+			}
+			int tile_idx = mem_ppu_get_tilemap(ppu->mem, map_sel)[(y / 8) * 32 + tilex];
+			f->tile_idx_eff = ((lcdc >> 4) & 1) ?  // converted to 0..383
+			                  tile_idx :
+			                  256 + (tile_idx & 0x7F) - (tile_idx & 0x80);
+		}
+		else if (f->step == FETCH_DATA_HI) { // both bytes of tile row available now
+			int y = f->win_active ? ppu->wy_counter : ppu->ly + regs[PPU_REG_SCY];
+			mem_ppu_copy_tile_row(ppu->mem, f->tile_row, f->tile_idx_eff, y & 7, false);
+		}
+	}
+	if (++f->step_dots == 2) {
+		f->step_dots = 0;
+		++f->step;
+	}
+}
+
+static
+void ppu_fifo_merge_obj(struct ppu* ppu, struct ppu_fifo* f, u8 lcdc) {
+	// object fetch done: mix its row into obj FIFO. Pixels already there win (lower x or OAM index)
+	struct obj_attributes* obj = &f->objs[f->obj_fetch];
+	int obj_height = 8 + ((lcdc >> 2) & 1) * 8;
+	bool fliplr = ((obj->flags >> 5) & 1) == 1;
+	bool flipud = ((obj->flags >> 6) & 1) == 1;
+	int y_in_tile = ppu->ly + 16 - obj->y;
+	if (flipud)
+		y_in_tile = obj_height - 1 - y_in_tile;
+	int tile_idx = obj_height == 16 ? (obj->tile_idx & 0xFE) : obj->tile_idx;
+	if (y_in_tile >= 8) {
+		y_in_tile -= 8;
+		++tile_idx;
+	}
+	gb_color_idx row[8];
+	mem_ppu_copy_tile_row(ppu->mem, row, tile_idx, y_in_tile, fliplr);
+
+	int skip = f->lx + 8 - obj->x; // pixels left of screen
+	for (int ii = 0; ii < 8 - skip; ++ii) {
+		struct obj_pixel* px = &f->obj_fifo[(f->obj_head + ii) & 7];
+		if (ii >= f->obj_len || px->col_idx == 0) {
+			px->col_idx = row[skip + ii];
+			px->flags = obj->flags;
+		}
+	}
+	if (f->obj_len < 8 - skip)
+		f->obj_len = 8 - skip;
+	f->obj_fetch = -1;
+}
+
+static
+void ppu_fifo_push_pixel(struct ppu* ppu, struct ppu_fifo* f, const u8 regs[NR_PPU_REGS]) {
+	gb_color_idx bg_col_idx = f->bg_fifo[f->bg_pos++];
+	--f->bg_len;
+	if (f->discard > 0) {
+		--f->discard;
+		return;
+	}
+	struct obj_pixel obj = {0, 0};
+	if (f->obj_len > 0) {
+		obj = f->obj_fifo[f->obj_head];
+		f->obj_head = (f->obj_head + 1) & 7;
+		--f->obj_len;
+	}
+	if (ppu->render_frame) {
+		u8 lcdc = regs[PPU_REG_LCDC];
+		bool bgwin_enbl = (lcdc >> 0) & 1;
+		bool obj_enbl = (lcdc >> 1) & 1;
+		if (!bgwin_enbl)
+			bg_col_idx = 0;
+		gb_color col = bgwin_enbl ? (regs[PPU_REG_BGP] >> (2 * bg_col_idx)) & 3 : 0; // WHITE when !bgwin_enbl
+		bool prio = ((obj.flags >> 7) & 1) == 1;
+		if (obj_enbl && obj.col_idx != 0 && !(prio && bg_col_idx != 0)) {
+			u8 obp = ((obj.flags >> 4) & 1) ? regs[PPU_REG_OBP1] : regs[PPU_REG_OBP0];
+			col = (obp >> (2 * obj.col_idx)) & 3;
+		}
+		f->line[f->lx] = col;
+	}
+	++f->lx;
+}
+
+static
+void ppu_fifo_draw_dot(struct ppu* ppu, struct ppu_fifo* f) {
+	// one dot of mode 3. Registers are read live, so mid-line writes take effect right away
+	u8 regs[NR_PPU_REGS];
+	mem_ppu_get_line_regs(ppu->mem, regs);
+	u8 lcdc = regs[PPU_REG_LCDC];
+
+	if (f->warmup > 0) {
+		--f->warmup;
+		return;
+	}
+
+	// window starts: restart fetcher on window tiles (bg FIFO is cleared)
+	u8 wx = regs[PPU_REG_WX];
+	if (!f->win_active && ppu->wy_condition && (lcdc & 0x01) && (lcdc & 0x20) && wx <= 166 &&
+	    f->lx + 7 >= wx) {
+		f->win_active = true;
+		f->win_drawn = true;
+		f->fetch_x = 0;
+		f->step = FETCH_TILE;
+		f->step_dots = 0;
+		f->bg_len = 0;
+		f->discard = wx < 7 ? 7 - wx : 0;
+	}
+
+	// object reached: pixel output stalls until its row is fetched. Several at once (x < 8 at
+	// left edge): lowest x first, equal x in OAM order, as pixels merged first win
+	if (f->obj_fetch < 0 && (lcdc & 0x02)) {
+		int next = -1;
+		for (int ii = 0; ii < f->nr_objs; ++ii) {
+			if (!f->obj_fetched[ii] && f->objs[ii].x <= f->lx + 8 &&
+			    (next < 0 || f->objs[ii].x < f->objs[next].x))
+				next = ii;
+		}
+		if (next >= 0) {
+			f->obj_fetched[next] = true;
+			f->obj_fetch = next;
+			f->obj_fetch_dots = OBJ_FETCH_DOTS;
+		}
+	}
+	if (f->obj_fetch >= 0) {
+		// background fetch in progress is completed first
+		if (f->step != FETCH_PUSH || f->bg_len == 0)
+			ppu_fifo_fetch_dot(ppu, f, regs);
+		else if (--f->obj_fetch_dots == 0)
+			ppu_fifo_merge_obj(ppu, f, lcdc);
+		return;
+	}
+
+	ppu_fifo_fetch_dot(ppu, f, regs);
+	if (f->bg_len > 0)
+		ppu_fifo_push_pixel(ppu, f, regs);
+
+	if (f->lx == LCD_WIDTH) { // line done: mode 3 ends here
+		f->drawing = false;
+		ppu->mode = PPU_MODE_HBLANK;
+		if (f->win_drawn)
+			++ppu->wy_counter;
+		if (ppu->render_frame) {
+			ppu_store_lcd_line(ppu, ppu->ly, f->line);
+			if (ppu->output.pixels)
+				ppu_output_line(ppu, ppu->ly);
+		}
+	}
+}
+
+static
+void ppu_fifo_dot(struct ppu* ppu, struct ppu_fifo* f) {
+	// mode changes at fixed dots, except end of mode 3
+	if (ppu->xdot == 0) {
+		if (ppu->ly < LY_VBLANK) {
+			u8 wy;
+			mem_ppu_get_wxwy(ppu->mem, NULL, &wy);
+			ppu->wy_condition = ppu->wy_condition || wy == ppu->ly;
+			ppu->mode = PPU_MODE_OAMSCAN;
+			f->drawing = false;
+			ppu_fifo_oam_scan(ppu, f);
+		}
+		else if (ppu->ly == LY_VBLANK) {
+			ppu_vblank(ppu);
+			ppu->mode = PPU_MODE_VBLANK;
+			ppu->wy_condition = false;
+			ppu->wy_counter = 0;
+		}
+	}
+	else if (ppu->xdot == XDOT_OAMSCAN && ppu->ly < LY_VBLANK) {
+		ppu->mode = PPU_MODE_DRAW;
+		ppu_fifo_start_line(ppu, f);
+	}
+
+	if (f->drawing)
+		ppu_fifo_draw_dot(ppu, f);
+
+	if (++ppu->xdot == XDOT_MAX) {
+		ppu->xdot = 0;
+		if (++ppu->ly == LY_MAX) {
+			ppu->ly = 0;
+			ppu->frame_done = true;
+			++ppu->nr_frames;
+			ppu_start_frame(ppu);
+		}
+	}
+}
+
+void ppu_fifo_mcycle(struct ppu* ppu) {
+	// called every CPU cycle instead of ppu_mcycle. Runs PPU dot by dot
+	if (ppu->resync)
+		ppu_update_enabled(ppu);
+	if (!ppu->enabled) { // LCD off: sleep until LCDC written. Counts the mcycle it went off too
+		ppu_lcd_off_mcycle(ppu);
+		return;
+	}
+
+	// one mcycle --> 4 dots (2 dots if cpu in double speed)
+	int dots = mem_is_cpu_double_speed(ppu->mem) ? 2 : 4;
+	for (int ii = 0; ii < dots; ++ii)
+		ppu_fifo_dot(ppu, ppu->fifo);
+
+	// Update STAT and LY, set interrupt flags
+	mem_ppu_report(ppu->mem, ppu->ly, (int)ppu->mode);
+}
@@ -0,0 +1,62 @@
+#ifndef __PPU_FIFO_H__
+#define __PPU_FIFO_H__
+
+#include <stdbool.h>
+#include "common.h"
+#include "ppu.h"
+
+// Dot accurate renderer: background/window fetcher, pixel FIFOs and object
+// fetches as on hardware, so mode 3 length depends on SCX, window and objects.
+// Selected with ppu_set_renderer(), much slower than line renderer
+
+enum fetch_step {
+	FETCH_TILE,
+	FETCH_DATA_LO,
+	FETCH_DATA_HI,
+	FETCH_PUSH
+};
+
+struct obj_pixel {
+	gb_color_idx col_idx;
+	u8           flags;
+};
+
+struct ppu_fifo {
+	bool drawing; // in mode 3 of a line started by this renderer
+
+	// objects on this line (OAM scan), in OAM order
+	struct obj_attributes objs[OBJS_PER_LINE];
+	int          nr_objs;
+	bool         obj_fetched[OBJS_PER_LINE];
+	int          obj_fetch;      // object being fetched (-1: none)
+	int          obj_fetch_dots; // dots left for object fetch
+
+	// background / window fetcher
+	enum fetch_step step;
+	int          step_dots;  // dots spent in current step (2 per step)
+	int          warmup;     // dots left of first (discarded) tile fetch
+	int          fetch_x;    // tile column (bg: relative to SCX / 8)
+	int          tile_idx_eff;
+	gb_color_idx tile_row[8];
+	bool         win_active; // fetching window tiles
+	bool         win_drawn;  // window started on this line
+
+	// pixel FIFOs
+	gb_color_idx bg_fifo[8];
+	int          bg_pos;
+	int          bg_len;
+	struct obj_pixel obj_fifo[8]; // ring
+	int          obj_head;
+	int          obj_len;
+
+	gb_color     line[LCD_WIDTH]; // stored to lcd when line is done
+	int          lx;      // next screen pixel
+	int          discard; // pixels to drop (SCX & 7, window with WX < 7)
+};
+
+// fifo in caller memory (part of ppu arena), returns fifo
+struct ppu_fifo* ppu_fifo_init(struct ppu_fifo* fifo);
+
+void ppu_fifo_mcycle(struct ppu* ppu);
+
+#endif
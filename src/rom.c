@@ -1,11 +1,12 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "rom.h"
 
 #define CARTTYPE_ADDR 0x0147
+#define BANK_SIZE     0x4000
 
-static
-u8* read_binary_file(const char* fname, unsigned int* size) {
+u8* rom_load_file(const char* fname, unsigned int* size) {
 	FILE *f = fopen(fname, "rb");
 	if (!f) {
 		fprintf(stderr, "Error loading ROM file %s", fname);
@@ -20,29 +21,63 @@ u8* read_binary_file(const char* fname, unsigned int* size) {
 	return data;
 }
 
-struct rom* rom_create(const char* filename) {
-	struct rom* rom = malloc(sizeof(struct rom));
-	rom->size = 0;
-	rom->data = read_binary_file(filename, &rom->size);
-	//printf("Loaded %s: size $%04X (%u)\n", filename, rom->size, rom->size);
+static
+u32 rom_hash(const u8* data, unsigned int size) {
+	// FNV-1a on 32 bit words (headers alone don't tell builds of homebrew apart)
+	u32 hash = 0x811C9DC5;
+	unsigned int ii = 0;
+	for (; ii + 4 <= size; ii += 4) {
+		u32 word;
+		memcpy(&word, &data[ii], sizeof(word));
+		hash = (hash ^ word) * 0x01000193;
+	}
+	for (; ii < size; ++ii)
+		hash = (hash ^ data[ii]) * 0x01000193;
+	return hash;
+}
+
+static
+unsigned int rom_padded_size(unsigned int size) {
+	// whole banks, at least banks 0 and 1: every bank number reads inside data
+	size = (size + BANK_SIZE - 1) / BANK_SIZE * BANK_SIZE;
+	return size < 2 * BANK_SIZE ? 2 * BANK_SIZE : size;
+}
+
+size_t rom_arena_size(unsigned int size) {
+	return CACHE_ALIGN(sizeof(struct rom)) + CACHE_ALIGN(rom_padded_size(size));
+}
+
+void rom_init(struct rom* rom, const void* data, unsigned int size) {
+	// ROM gets its own copy of data, right after struct. Padding reads as 0xFF (no data)
+	rom->size = rom_padded_size(size);
+	rom->nr_banks = rom->size / BANK_SIZE;
+	rom_relink(rom);
+	memcpy(rom->data, data, size);
+	memset(rom->data + size, 0xFF, rom->size - size);
 	rom->bank = 1;
-	return rom;
+	rom->hash = rom_hash(rom->data, rom->size);
 }
 
-void rom_destroy(struct rom* rom) {
-	if (rom) {
-		free(rom->data);
-		free(rom);
-	}
+void rom_relink(struct rom* rom) {
+	rom->data = (u8*)rom + CACHE_ALIGN(sizeof(struct rom));
 }
 
 u16 rom_get_type(struct rom* rom) {
 	return rom->data[CARTTYPE_ADDR] & 0x0FF;
 }
 
+u32 rom_get_hash(struct rom* rom) {
+	return rom->hash;
+}
+
+unsigned int rom_get_nr_banks(struct rom* rom) {
+	return rom->nr_banks;
+}
+
 u8 rom_read(struct rom* rom, u16 addr) {
 	unsigned int addr_eff = addr;
-	addr_eff = addr_eff >= 0x4000 ? (addr & 0x3FFF) + rom->bank * 0x4000 : addr_eff;
+	if (addr_eff >= BANK_SIZE) // bank < nr_banks (rom_write, load state check)
+		addr_eff = (addr & (BANK_SIZE - 1)) + rom->bank * BANK_SIZE;
 	return rom->data[addr_eff];
 }
 
@@ -54,13 +89,14 @@ void rom_write(struct rom* rom, u16 addr, u8 value) {
 		case 1: // ROM bank nr
 			rom->bank = value & 0x1F;
 			rom->bank = rom->bank == 0 ? 1 : rom->bank;
+			rom->bank %= rom->nr_banks; // bank register has more bits than the ROM has banks
 			//printf("ROM: selected bank %u\n", rom->bank);
 			break;
 		case 2: // RAM bank nr or upper 2 bits of bank nr
-			printf("ROM: write to 0x4000 - 0x5FFF not implemented yet\n");
+			fprintf(stderr, "ROM: write to 0x4000 - 0x5FFF not implemented yet\n");
 			break;
 		case 3: // Banking mode
-			printf("ROM: write to 0x6000 - 0x7FFF not implemented yet\n");
+			fprintf(stderr, "ROM: write to 0x6000 - 0x7FFF not implemented yet\n");
 			break;
 	}
 }
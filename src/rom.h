@@ -6,14 +6,24 @@
 
 struct rom {
 	u8*          data;
-	unsigned int size;
-	unsigned int bank;
+	unsigned int size;     // whole banks, at least 2 (ROM is padded)
+	unsigned int nr_banks;
+	unsigned int bank;     // < nr_banks
+	u32          hash;
 };
 
-struct rom* rom_create(const char* filename);
-void rom_destroy(struct rom* rom);
+// whole file, to be freed by caller. NULL on error
+u8* rom_load_file(const char* fname, unsigned int* size);
+
+// rom in caller memory of rom_arena_size() bytes (part of gameboy arena). ROM data is copied
+// behind struct
+size_t rom_arena_size(unsigned int size);
+void rom_init(struct rom* rom, const void* data, unsigned int size);
+void rom_relink(struct rom* rom); // rom was copied to another address
 
 u16 rom_get_type(struct rom* rom);
+unsigned int rom_get_nr_banks(struct rom* rom);
+u32 rom_get_hash(struct rom* rom); // of whole ROM data, identifies game and build
 
 u8 rom_read(struct rom* rom, u16 addr);
 void rom_write(struct rom* rom, u16 addr, u8 value);
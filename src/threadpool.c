@@ -0,0 +1,220 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "threadpool.h"
+
+// tasks left for one worker: range [head, tail). Owner takes from head, thieves from tail.
+// Changed under lock, but stored atomically: thieves read them without lock to pick a victim
+struct task_range {
+	pthread_mutex_t lock;
+	int             head;
+	int             tail;
+} __attribute__((aligned(64))); // one cache line per worker
+
+struct threadpool_worker {
+	struct threadpool* pool;
+	pthread_t          thread;
+	int                idx;
+};
+
+struct threadpool {
+	int                       nr_threads;
+	struct threadpool_worker* workers;
+	struct task_range*        ranges;
+
+	// current batch, set under lock
+	threadpool_fn             fn;
+	void*                     ctx;
+
+	pthread_mutex_t           lock;
+	pthread_cond_t            start;      // new batch (generation changed) or quit
+	pthread_cond_t            done;       // all workers finished the batch
+	unsigned int              generation; // batch counter
+	int                       finished;   // workers done with current generation
+	bool                      quit;
+};
+
+static
+bool threadpool_take_own(struct task_range* range, int* task) {
+	bool ok = false;
+	pthread_mutex_lock(&range->lock);
+	if (range->head < range->tail) {
+		*task = range->head;
+		__atomic_store_n(&range->head, range->head + 1, __ATOMIC_RELAXED);
+		ok = true;
+	}
+	pthread_mutex_unlock(&range->lock);
+	return ok;
+}
+
+static
+bool threadpool_steal(struct threadpool* pool, int thief) {
+	// move back half of the largest range of another worker into own range
+	struct task_range* own = &pool->ranges[thief];
+	for (;;) {
+		int victim = -1;
+		int most = 0;
+		for (int ii = 0; ii < pool->nr_threads; ++ii) {
+			int left = __atomic_load_n(&pool->ranges[ii].tail, __ATOMIC_RELAXED) -
+			           __atomic_load_n(&pool->ranges[ii].head, __ATOMIC_RELAXED);
+			if (ii != thief && left > most) {
+				victim = ii;
+				most = left;
+			}
+		}
+		if (victim < 0)
+			return false;
+
+		struct task_range* vr = &pool->ranges[victim];
+		pthread_mutex_lock(&vr->lock);
+		int left = vr->tail - vr->head;
+		if (left <= 0) { // emptied in the meantime: look again
+			pthread_mutex_unlock(&vr->lock);
+			continue;
+		}
+		int mid = vr->tail - (left + 1) / 2;
+		int tail = vr->tail;
+		__atomic_store_n(&vr->tail, mid, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&vr->lock);
+
+		pthread_mutex_lock(&own->lock);
+		__atomic_store_n(&own->head, mid, __ATOMIC_RELAXED);
+		__atomic_store_n(&own->tail, tail, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&own->lock);
+		return true;
+	}
+}
+
+static
+void threadpool_work(struct threadpool* pool, int idx) {
+	// all ranges empty when it returns, tasks of other workers may still be running
+	int task;
+	for (;;) {
+		if (threadpool_take_own(&pool->ranges[idx], &task))
+			pool->fn(pool->ctx, task, idx);
+		else if (!threadpool_steal(pool, idx))
+			break;
+	}
+}
+
+static
+void* threadpool_worker_run(void* arg) {
+	struct threadpool_worker* worker = arg;
+	struct threadpool* pool = worker->pool;
+	unsigned int generation = 0;
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->lock);
+		bool quit = pool->quit;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+		if (quit)
+			break;
+		threadpool_work(pool, worker->idx);
+
+		// batch is only done when every worker has seen it and no longer touches the ranges,
+		// so none can wake late and pick up the next batch half set up
+		pthread_mutex_lock(&pool->lock);
+		if (++pool->finished == pool->nr_threads)
+			pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	return NULL;
+}
+
+struct threadpool* threadpool_create(int nr_threads, bool pin_cores) {
+	int nr_cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_cores < 1)
+		nr_cores = 1;
+	if (nr_threads <= 0)
+		nr_threads = nr_cores;
+
+	struct threadpool* pool = malloc(sizeof(struct threadpool));
+	if (!pool)
+		return NULL;
+	pool->nr_threads = 0; // started so far
+	pool->workers = malloc(nr_threads * sizeof(struct threadpool_worker));
+	pool->ranges = aligned_alloc(64, nr_threads * sizeof(struct task_range));
+	pool->fn = NULL;
+	pool->ctx = NULL;
+	pool->generation = 0;
+	pool->finished = 0;
+	pool->quit = false;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	if (!pool->workers || !pool->ranges) {
+		threadpool_destroy(pool);
+		return NULL;
+	}
+
+	for (int ii = 0; ii < nr_threads; ++ii) {
+		pthread_mutex_init(&pool->ranges[ii].lock, NULL);
+		pool->ranges[ii].head = 0;
+		pool->ranges[ii].tail = 0;
+		struct threadpool_worker* worker = &pool->workers[ii];
+		worker->pool = pool;
+		worker->idx = ii;
+		if (pthread_create(&worker->thread, NULL, threadpool_worker_run, worker) != 0) {
+			pthread_mutex_destroy(&pool->ranges[ii].lock);
+			threadpool_destroy(pool); // stops the ones started
+			return NULL;
+		}
+		++pool->nr_threads;
+		if (pin_cores) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(ii % nr_cores, &cpus);
+			if (pthread_setaffinity_np(worker->thread, sizeof(cpus), &cpus) != 0)
+				fprintf(stderr, "Warning: could not pin worker %d to core %d\n", ii, ii % nr_cores);
+		}
+	}
+	return pool;
+}
+
+void threadpool_destroy(struct threadpool* pool) {
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+	for (int ii = 0; ii < pool->nr_threads; ++ii) { // started ones only
+		pthread_join(pool->workers[ii].thread, NULL);
+		pthread_mutex_destroy(&pool->ranges[ii].lock);
+	}
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->ranges);
+	free(pool->workers);
+	free(pool);
+}
+
+int threadpool_get_nr_threads(struct threadpool* pool) {
+	return pool->nr_threads;
+}
+
+void threadpool_run(struct threadpool* pool, threadpool_fn fn, void* ctx, int nr_tasks) {
+	if (nr_tasks <= 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	// contiguous blocks: neighbouring tasks (e.g. same ROM, other config) stay on one worker.
+	// No worker is in a batch now (previous run waited for all), published by the lock
+	for (int ii = 0; ii < pool->nr_threads; ++ii) {
+		pool->ranges[ii].head = (int)((long)nr_tasks * ii / pool->nr_threads);
+		pool->ranges[ii].tail = (int)((long)nr_tasks * (ii + 1) / pool->nr_threads);
+	}
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->finished = 0;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	while (pool->finished < pool->nr_threads)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
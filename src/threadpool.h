@@ -0,0 +1,23 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <stdbool.h>
+
+// Work-stealing thread pool for batches of independent tasks (many emulator instances).
+// Each worker starts with its own block of task numbers and takes them front to back.
+// A worker that runs out steals the back half of the block of another worker
+
+// called for each task; worker: 0 .. nr_threads - 1 (index into per-thread data)
+typedef void (*threadpool_fn)(void* ctx, int task, int worker);
+
+// nr_threads <= 0: one per online core. pin_cores: worker n runs on core n % nr cores.
+// NULL: out of memory or threads could not be started
+struct threadpool* threadpool_create(int nr_threads, bool pin_cores);
+void threadpool_destroy(struct threadpool* pool);
+
+int threadpool_get_nr_threads(struct threadpool* pool);
+
+// run fn for tasks 0 .. nr_tasks - 1, returns when all are done. Not reentrant
+void threadpool_run(struct threadpool* pool, threadpool_fn fn, void* ctx, int nr_tasks);
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include "timers.h"
 #include "mem.h"
 
@@ -9,16 +10,25 @@
 #define DIVCOUNT 64 /* 2^20 Hz / 16384 Hz */
 
 
-struct timers* timers_create(struct mem* mem) {
-	struct timers* timers = malloc(sizeof(struct timers));
+void timers_init(struct timers* timers, struct mem* mem) {
 	timers->count_div = 0;
 	timers->count_tima = 0;
 	timers->mem = mem;
-	return timers;
 }
 
-void timers_destroy(struct timers* timers) {
-	free(timers);
+size_t timers_state_size(void) {
+	return sizeof(struct timers);
+}
+
+void timers_save_state(struct timers* timers, void* buf) {
+	memcpy(buf, timers, sizeof(struct timers));
+	STATE_CLEAR(buf, struct timers, mem);
+}
+
+void timers_load_state(struct timers* timers, const void* buf) {
+	struct mem* mem = timers->mem;
+	memcpy(timers, buf, sizeof(struct timers));
+	timers->mem = mem;
 }
 
 void timers_mcycle(struct timers* timers) { // called every M-cycle = 4 T-cycles
@@ -1,6 +1,7 @@
 #ifndef __TIMERS_H__
 #define __TIMERS_H__
 
+#include <stddef.h>
 #include "mem.h"
 
 struct timers {
@@ -11,10 +12,15 @@ struct timers {
 	// The actual timer contents are in mem
 };
 
-struct timers* timers_create(struct mem* mem);
-void timers_destroy(struct timers* timers);
+// timers in caller memory (part of gameboy arena)
+void timers_init(struct timers* timers, struct mem* mem);
 
 void timers_mcycle(struct timers* timers);
 
+// save states: timers_load_state keeps connection to mem
+size_t timers_state_size(void);
+void timers_save_state(struct timers* timers, void* buf);
+void timers_load_state(struct timers* timers, const void* buf);
+
 #endif
 
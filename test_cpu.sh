@@ -1,8 +1,13 @@
 #!/bin/bash
+# -f: run all ROMs in parallel in one process (make farm), JSON result per ROM
+
+if [ "$1" = "-f" ]; then
+	ls roms/gb-test-roms/cpu_instrs/individual/*.gb | ./bin/limeguy-farm -m 0 -i 9000000 -
+	exit $?
+fi
 
 for f in roms/gb-test-roms/cpu_instrs/individual/*.gb; do
 	echo "-------------------------------------------"
 	echo ${f}
 	./limeguy m9000000 "${f}"
 done
-